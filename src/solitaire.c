@@ -23,14 +23,111 @@ pebble install --phone 192.168.1.108
 */
 #include <pebble.h>
 
+/* Uncomment to build with frame-time and input-latency instrumentation (Tools > Profile) */
+//#define PROFILE
+
+/* Uncomment (with PROFILE) to quit with an error log when heap use exceeds this many bytes */
+//#define MEMORY_BUDGET 12000
+
+/* Uncomment (with PROFILE) to log every frame for tools/bench/emu_bench.py */
+//#define BENCHMARK
+
+/* Uncomment to deal the same board on every Re-deal */
+//#define DEAL_SEED 1
+
+#define TRACE_CAT_RULES 0x01
+#define TRACE_CAT_SELECTION 0x02
+#define TRACE_CAT_DEAL 0x04
+#define TRACE_CAT_PERSIST 0x08
+#define TRACE_CAT_RENDER 0x10
+/* Uncomment to log trace records for the selected categories (see Tracing below) */
+//#define TRACE (TRACE_CAT_RULES | TRACE_CAT_SELECTION | TRACE_CAT_DEAL | TRACE_CAT_PERSIST | TRACE_CAT_RENDER)
+
+/*
+	Rules variant. Each variant describes its capacities and the rules that
+	run on every move as macros, so the variant built in is specialized at
+	compile time and costs nothing at run time. Piles, arrays, the deal and
+	persistence are sized from these. Every variant plays one 52 card deck:
+	the card is rank << 2 | suit, each suit has a foundation built up from
+	the ace, and a card fits the byte it is saved in.
+	Macro				Meaning
+	-----				-------
+	TABLEAU_PILES			tableau piles, left to right
+	HIDDEN_MAX			most face down cards in a tableau pile
+	SHOWING_MAX			most face up cards in a tableau pile
+	STOCK_SIZE			cards left in the stock after the deal
+	DEAL_HIDDEN(i)			face down cards dealt to tableau pile i
+	DEAL_SHOWING(i)			face up cards dealt to tableau pile i
+	TABLEAU_BUILDS(sr, ss, dr, ds)	card of rank sr, suit ss may go on rank dr, suit ds
+	TABLEAU_EMPTY_TAKES(sr)		card of rank sr may start an empty tableau pile
+	TEXT_HELP, TEXT_ABOUT		help and about text resources for the variant
+	Thumb and Pouch is Klondike built down in any other suit, with any card
+	allowed into an empty pile. Build with -DVARIANT=1 for it. Variants with
+	more decks (Spider) or other deal and move rules (FreeCell) need more
+	than a block here.
+*/
+#define VARIANT_KLONDIKE 0
+#define VARIANT_THUMB_AND_POUCH 1
+#ifndef VARIANT
+#define VARIANT VARIANT_KLONDIKE
+#endif
+
+#if VARIANT == VARIANT_KLONDIKE
+#define TABLEAU_PILES 7
+#define HIDDEN_MAX (TABLEAU_PILES - 1)
+#define SHOWING_MAX RANKS
+#define STOCK_SIZE (CARDS - TABLEAU_PILES * (TABLEAU_PILES + 1) / 2)
+#define DEAL_HIDDEN(i) (i)
+#define DEAL_SHOWING(i) 1
+#define TABLEAU_BUILDS(sr, ss, dr, ds) ((sr) == (dr) - 1 && ((ss) >> 1) != ((ds) >> 1))
+#define TABLEAU_EMPTY_TAKES(sr) ((sr) == KING)
+#define TEXT_HELP RESOURCE_ID_TEXT_HELP
+#define TEXT_ABOUT RESOURCE_ID_TEXT_ABOUT
+#elif VARIANT == VARIANT_THUMB_AND_POUCH
+#define TABLEAU_PILES 7
+#define HIDDEN_MAX (TABLEAU_PILES - 1)
+#define SHOWING_MAX RANKS
+#define STOCK_SIZE (CARDS - TABLEAU_PILES * (TABLEAU_PILES + 1) / 2)
+#define DEAL_HIDDEN(i) (i)
+#define DEAL_SHOWING(i) 1
+#define TABLEAU_BUILDS(sr, ss, dr, ds) ((sr) == (dr) - 1 && (ss) != (ds))
+#define TABLEAU_EMPTY_TAKES(sr) true
+#define TEXT_HELP RESOURCE_ID_TEXT_HELP_THUMB_AND_POUCH
+#define TEXT_ABOUT RESOURCE_ID_TEXT_ABOUT_THUMB_AND_POUCH
+#else
+#error "unknown VARIANT"
+#endif
+#define SUITS 4
+#define RANKS 13
+#define KING (RANKS - 1)
+#define CARDS (SUITS * RANKS)
+#define FOUNDATION_PILES SUITS
+#define TABLEAU_DEPTH (HIDDEN_MAX + SHOWING_MAX)
+
 #define MODE_SELECT_SRC 0
 #define MODE_SELECT_DEST 1
 #define PILE_TABLEAU_LEFT 0
-#define PILE_TABLEAU_RIGHT 6
-#define PILE_TALON 7
-#define PILE_FOUNDATIONS 8
+#define PILE_TABLEAU_RIGHT (TABLEAU_PILES - 1)
+#define PILE_TALON TABLEAU_PILES
+#define PILE_FOUNDATIONS (TABLEAU_PILES + 1)
 #define PILE_FOUNDATION_LEFT 0
-#define PILE_FOUNDATION_RIGHT 3
+#define PILE_FOUNDATION_RIGHT (FOUNDATION_PILES - 1)
+#define VIEW_COMPACT 0
+#define VIEW_EXPANDED 1
+#define START_MENU 0
+#define START_GAME 1
+#define EXPANDED_CARD_SPACING 16
+#define PERSIST_KEY_STATE 0
+#define PERSIST_KEY_OPTIONS 1
+#define PERSIST_KEY_REPLAY 2 /* header, then REPLAY_KEYS keys of moves */
+#define PERSIST_KEY_HISTORY 10 /* header, then HISTORY_SHARDS keys of records */
+#define PERSIST_STORAGE_LIMIT 4096
+#define TEXT_CHUNK 512
+#define TEXT_MAX_PAGES 24
+#define MOVE_ANIMATION_MS 180
+#define AUTO_MOVE_ANIMATION_MS 120
+#define ANIMATION_FRAME_MS 33
+#define INPUT_QUEUE_SIZE 8
 
 /******************************************************************************/
 /* Globals                                                                    */
@@ -46,65 +143,996 @@ static GBitmap *back_image;
 static GBitmap *edge_image;
 static GBitmap *selector_image;
 static GBitmap *mode1_image;
-static GBitmap *rank_image[13];
-static GBitmap *suit_image[4];
+static GBitmap *rank_image[RANKS];
+static GBitmap *suit_image[SUITS];
 static int seed;
-static int deck[52];
+static int deck[CARDS];
 static int stock_count;
 static int talon;
 static int talon_showing;
 static int flips;
-static int stock[24];
-static int foundation[4];
-static int tableau[7][19];
-static int hidden_count[7];
-static int tableau_count[7];
+static int stock[STOCK_SIZE];
+static int foundation[FOUNDATION_PILES];
+static int tableau[TABLEAU_PILES][TABLEAU_DEPTH];
+static int hidden_count[TABLEAU_PILES];
+static int tableau_count[TABLEAU_PILES];
 static int mode;
 static int selection;
 static int source;
 static bool win;
+static int auto_move_pile;
+static bool auto_move_success;
+
+// history of the current game
+static uint16_t game_moves;
+static uint16_t game_seconds;
+static time_t game_action_time;
+static bool game_recorded;
+
+// card move animation
+static Layer *flying_layer;
+static Layer *repair_layer;
+static Animation *move_animation;
+static bool auto_moving;
+static bool animation_instant;
+static bool animation_frame;
+static bool repairing;
+static int flying_card = -3;
+static GPoint flying_from;
+static GPoint flying_to;
+static GRect flying_damage;
+static uint32_t animation_frame_start;
+static uint32_t animation_next_frame;
+static int move_dest;
+static int move_dest_count;
+static int move_card;
+static GPoint move_from_single;
+static GPoint move_from_pile;
+static int move_scroll;
+static ClickHandler input_queue[INPUT_QUEUE_SIZE];
+static int input_queue_count;
 
 // text area
-static char* HELP_TEXT = "Controls\n\n"
-				"Up: Select next card pile. Automatically skips ineligible piles.\n\n"
-				"Select: Begin or complete a card move.\n\n"
-				"Down (short): Deal card to talon or abort a card move in progress.\n\n"
-				"Down (long): Automatically move cards from tableau to foundation piles.\n\n"
-				"Gameplay\n\n"
-				"Due to display limitations, only the top- and bottom-most face up cards from each tableau pile are shown.\n\n"
-				"Either an entire pile or the topmost card in a tableau pile may be moved, but partial pile moves are not possible.\n\n"
-				"Once a card is moved to the foundation, it may not be moved back.";
-static char* ABOUT_TEXT = "Klondike Solitaire\n\n"
-				"Copyright (c) 2014 Jeffry Johnston <pebble@kidsquid.com>\n\n"
-				"License GPLv3+: GNU GPL version 3 or later <http://gnu.org/licenses/gpl.html>.\n"
-				"This is free software: you are free to change and redistribute it.\n"
-				"There is NO WARRANTY, to the extent permitted by law.";
 static Window *text_window;
-static ScrollLayer *text_scroll_layer;
 static Layer *text_window_layer;
-static TextLayer *text_layer;
-static char *text;
+static Layer *text_page_layer;
+static uint32_t text_resource;
+static const char *text;
+static size_t text_length;
+static uint16_t text_page_start[TEXT_MAX_PAGES + 1];
+static int text_pages_known;
+static int text_last_page;
+static int text_page;
+static int text_chunk_page;
+static char text_chunk[TEXT_CHUNK + 1];
 
 // menu and settings
 static Window *menu_window;
 static SimpleMenuLayer *simple_menu_layer;
 static SimpleMenuSection menu_sections[3]; /* Game, Settings, Tools */
 static SimpleMenuItem game_menu_items[2]; /* Play, Re-deal */
-static SimpleMenuItem settings_menu_items[3]; /* Draw [One, Three], Flips [No Limit, One, Three], Score [Show, Hide] */
-static SimpleMenuItem tools_menu_items[3]; /* Reset Score, Help, About */
+static SimpleMenuItem settings_menu_items[5]; /* Draw [One, Three], Flips [No Limit, One, Three], Score [Show, Hide], View [Compact, Expanded], Start [Menu, Game] */
+#ifdef PROFILE
+static SimpleMenuItem tools_menu_items[6]; /* Reset Score, Help, About, Export Replay, Statistics, Profile */
+#else
+static SimpleMenuItem tools_menu_items[5]; /* Reset Score, Help, About, Export Replay, Statistics */
+#endif
 static const char *draw_options[] = {"One Card", "Three Cards"};
 static const char *fliplimit_options[] = {"No Limit", "Zero", "One", "Three"};
 static const char *score_options[] = {"Show", "Hide"};
+static const char *view_options[] = {"Compact", "Expanded"};
+static const char *start_options[] = {"Menu", "Game"};
 static int draw_setting;
 static int fliplimit_setting;
 static int score_setting;
+static int view_setting;
+static int start_setting;
+static bool state_loaded;
+
+/******************************************************************************/
+/* Profiling                                                                  */
+/******************************************************************************/
+/*
+	With PROFILE defined, every click handler stamps its entry time and the
+	next game_window_layer_update_callback records the latency up to the end
+	of drawing. Selection logic, rule checks (including the moves they guard)
+	and drawing are timed separately; the partial redraws behind a moving card
+	are timed on their own so they stay out of the Draw histogram. Bitmap
+	blits and rule evaluations are counted per frame. Samples go into fixed
+	power-of-two millisecond histograms: bucket 0 holds 0 ms, bucket n holds
+	2^(n-1) to 2^n - 1 ms and the last bucket holds everything slower. When
+	the app starts straight into the game, the time from init to the end of
+	the first game frame is kept as well, and card move animations count the
+	frames they draw and skip. Heap allocations are tagged by subsystem by
+	measuring heap_bytes_used() around them, and heap high-water marks are
+	taken at every window load and unload. With MEMORY_BUDGET also defined, a
+	checkpoint that finds more heap in use than the budget logs an error and
+	quits the app.
+	Without PROFILE all of the macros below compile to nothing.
+*/
+#ifdef PROFILE
+#define PROFILE_BUCKETS 10
+#define PROFILE_LATENCY 0
+#define PROFILE_SELECTION 1
+#define PROFILE_RULES 2
+#define PROFILE_DRAW 3
+#define PROFILE_REPAIR 4
+#define PROFILE_METRICS 5
+
+typedef struct {
+	uint16_t bucket[PROFILE_BUCKETS];
+	uint32_t samples;
+	uint32_t total;
+	uint32_t max;
+} ProfileHistogram;
+
+static const char *profile_metric_names[PROFILE_METRICS] = {"Latency", "Selection", "Rules", "Draw", "Repair"};
+static ProfileHistogram profile_histograms[PROFILE_METRICS];
+static ProfileHistogram profile_blits;
+static ProfileHistogram profile_rule_evals;
+static uint32_t profile_input_start;
+static bool profile_input_pending;
+static uint32_t profile_frame_blits;
+static uint32_t profile_frame_rule_evals;
+static uint32_t profile_startup_start;
+static uint32_t profile_startup_ms;
+static uint32_t profile_animation_frames;
+static uint32_t profile_animation_skipped;
+static char profile_text[1024];
+
+#define MEMORY_BITMAPS 0
+#define MEMORY_TEXT 1
+#define MEMORY_MENU 2
+#define MEMORY_SUBSYSTEMS 3
+
+static const char *memory_subsystem_names[MEMORY_SUBSYSTEMS] = {"Bitmaps", "Text", "Menu"};
+static int32_t memory_current[MEMORY_SUBSYSTEMS];
+static int32_t memory_peak[MEMORY_SUBSYSTEMS];
+static size_t memory_used_peak;
+static size_t memory_free_low = (size_t)-1;
+
+static uint32_t profile_now()
+{
+	time_t t;
+	uint16_t ms;
+
+	time_ms(&t, &ms);
+	return (uint32_t)t * 1000 + ms;
+}
+
+static void profile_record(ProfileHistogram *h, uint32_t value)
+{
+	int b = 0;
+
+	while (b < PROFILE_BUCKETS - 1 && (value >> b) != 0) {
+		++b;
+	}
+	++h->bucket[b];
+	++h->samples;
+	h->total += value;
+	if (value > h->max) {
+		h->max = value;
+	}
+}
+
+static void profile_input()
+{
+	profile_input_start = profile_now();
+	profile_input_pending = true;
+}
+
+static void profile_frame_end(uint32_t draw_start)
+{
+	uint32_t now = profile_now();
+
+	profile_record(&profile_histograms[PROFILE_DRAW], now - draw_start);
+#ifdef BENCHMARK
+	// bench frame <latency ms, -1 if not caused by a press> <draw ms> <blits> <rule evaluations>
+	APP_LOG(APP_LOG_LEVEL_INFO, "bench frame %ld %lu %lu %lu", profile_input_pending ? (long)(now - profile_input_start) : -1L,
+		(unsigned long)(now - draw_start), (unsigned long)profile_frame_blits, (unsigned long)profile_frame_rule_evals);
+#endif
+	if (profile_input_pending) {
+		profile_record(&profile_histograms[PROFILE_LATENCY], now - profile_input_start);
+		profile_input_pending = false;
+	}
+	profile_record(&profile_blits, profile_frame_blits);
+	profile_record(&profile_rule_evals, profile_frame_rule_evals);
+	profile_frame_blits = 0;
+	profile_frame_rule_evals = 0;
+	if (profile_startup_start != 0) {
+		profile_startup_ms = now - profile_startup_start;
+		profile_startup_start = 0;
+		APP_LOG(APP_LOG_LEVEL_INFO, "startup to first game frame: %lu ms", (unsigned long)profile_startup_ms);
+	}
+}
+
+/* A partial redraw during an animation: timed as a repair, its blits and rule evaluations not charged to a frame */
+static void profile_repair_end(uint32_t draw_start)
+{
+	profile_record(&profile_histograms[PROFILE_REPAIR], profile_now() - draw_start);
+	profile_frame_blits = 0;
+	profile_frame_rule_evals = 0;
+}
+
+static int profile_format(char *buf, int size, const char *name, const ProfileHistogram *h)
+{
+	int n;
+	int i;
+
+	n = snprintf(buf, size, "%s n=%lu avg=%lu max=%lu\n", name, (unsigned long)h->samples,
+		(unsigned long)(h->samples ? h->total / h->samples : 0), (unsigned long)h->max);
+	for (i = 0; i < PROFILE_BUCKETS && n < size; ++i) {
+		n += snprintf(buf + n, size - n, "%u%s", h->bucket[i], (i < PROFILE_BUCKETS - 1) ? " " : "\n");
+	}
+	return (n < size) ? n : size - 1;
+}
+
+static void memory_track(int subsystem, size_t used_before)
+{
+	memory_current[subsystem] += (int32_t)(heap_bytes_used() - used_before);
+	if (memory_current[subsystem] > memory_peak[subsystem]) {
+		memory_peak[subsystem] = memory_current[subsystem];
+	}
+}
+
+static void memory_checkpoint(const char *where)
+{
+	size_t used = heap_bytes_used();
+	size_t free = heap_bytes_free();
+
+	if (used > memory_used_peak) {
+		memory_used_peak = used;
+	}
+	if (free < memory_free_low) {
+		memory_free_low = free;
+	}
+#ifdef MEMORY_BUDGET
+	if (used > MEMORY_BUDGET) {
+		APP_LOG(APP_LOG_LEVEL_ERROR, "memory budget exceeded at %s: %u > %u", where, (unsigned)used, (unsigned)MEMORY_BUDGET);
+		window_stack_pop_all(false);
+	}
+#endif
+}
+
+static int memory_format(char *buf, int size)
+{
+	int n;
+	int i;
+
+	n = snprintf(buf, size, "Heap used=%u peak=%u\nfree=%u low=%u\nGame state=%u\n",
+		(unsigned)heap_bytes_used(), (unsigned)memory_used_peak, (unsigned)heap_bytes_free(), (unsigned)memory_free_low,
+		(unsigned)(sizeof(deck) + sizeof(stock) + sizeof(foundation) + sizeof(tableau) + sizeof(hidden_count) + sizeof(tableau_count)));
+	for (i = 0; i < MEMORY_SUBSYSTEMS && n < size; ++i) {
+		n += snprintf(buf + n, size - n, "%s=%ld peak=%ld\n", memory_subsystem_names[i], (long)memory_current[i], (long)memory_peak[i]);
+	}
+	return (n < size) ? n : size - 1;
+}
+
+/* Format all histograms and memory use into profile_text and log them a line at a time */
+static char *profile_report()
+{
+	int n = 0;
+	int i;
+	char *line;
+	char *end;
+
+	for (i = 0; i < PROFILE_METRICS; ++i) {
+		n += profile_format(profile_text + n, sizeof(profile_text) - n, profile_metric_names[i], &profile_histograms[i]);
+	}
+	n += profile_format(profile_text + n, sizeof(profile_text) - n, "Blits/frame", &profile_blits);
+	n += profile_format(profile_text + n, sizeof(profile_text) - n, "Rules/frame", &profile_rule_evals);
+	n += snprintf(profile_text + n, sizeof(profile_text) - n, "Startup=%lu\n", (unsigned long)profile_startup_ms);
+	n += snprintf(profile_text + n, sizeof(profile_text) - n, "Anim frames=%lu skipped=%lu\n",
+		(unsigned long)profile_animation_frames, (unsigned long)profile_animation_skipped);
+	memory_format(profile_text + n, sizeof(profile_text) - n);
+
+	// one log message per line: the log cuts messages at about 256 bytes
+	APP_LOG(APP_LOG_LEVEL_INFO, "profile (ms buckets 0,1,2,4,...,256+)");
+	for (line = profile_text; *line != '\0'; line = end + 1) {
+		end = strchr(line, '\n');
+		if (end == NULL) {
+			APP_LOG(APP_LOG_LEVEL_INFO, "profile %s", line);
+			break;
+		}
+		*end = '\0';
+		APP_LOG(APP_LOG_LEVEL_INFO, "profile %s", line);
+		*end = '\n';
+	}
+	return profile_text;
+}
+
+#define PROFILE_INPUT() profile_input()
+#define PROFILE_START(name) uint32_t name = profile_now()
+#define PROFILE_STOP(name, metric) profile_record(&profile_histograms[metric], profile_now() - (name))
+#define PROFILE_FRAME_END(name) profile_frame_end(name)
+#define PROFILE_REPAIR_END(name) profile_repair_end(name)
+#define PROFILE_COUNT_BLIT() (++profile_frame_blits)
+#define PROFILE_COUNT_RULE() (++profile_frame_rule_evals)
+#define PROFILE_STARTUP() (profile_startup_start = profile_now())
+#define PROFILE_ANIMATION_FRAME(skipped) ((skipped) ? ++profile_animation_skipped : ++profile_animation_frames)
+#define MEMORY_TRACK_BEGIN(name) size_t name = heap_bytes_used()
+#define MEMORY_TRACK_END(name, subsystem) memory_track(subsystem, name)
+#define MEMORY_CHECKPOINT(where) memory_checkpoint(where)
+#else
+#define PROFILE_INPUT()
+#define PROFILE_START(name)
+#define PROFILE_STOP(name, metric)
+#define PROFILE_FRAME_END(name)
+#define PROFILE_REPAIR_END(name)
+#define PROFILE_COUNT_BLIT()
+#define PROFILE_COUNT_RULE()
+#define PROFILE_STARTUP()
+#define PROFILE_ANIMATION_FRAME(skipped)
+#define MEMORY_TRACK_BEGIN(name)
+#define MEMORY_TRACK_END(name, subsystem)
+#define MEMORY_CHECKPOINT(where)
+#endif
+
+/******************************************************************************/
+/* Tracing                                                                    */
+/******************************************************************************/
+/*
+	TRACE_<category>(a, b) appends an 8 byte record to a ring buffer:
+	Bytes	Description
+	-----	-----------
+	2	milliseconds, modulo 65536
+	2	category bit number << 13 | source line
+	2	a
+	2	b
+	Nothing is formatted on the hot path. A timer flushes the buffer to the log
+	in batches of TRACE_FLUSH_BATCH records per line, as "T" followed by each
+	record's four fields in hex; tools/trace_decode.py turns these lines back
+	into readable text. If the buffer fills before it is flushed, the oldest
+	records are dropped and counted.
+	Categories not selected by TRACE compile to nothing.
+*/
+#ifdef TRACE
+#define TRACE_BUFFER_SIZE 128
+#define TRACE_FLUSH_BATCH 8
+#define TRACE_FLUSH_DELAY 1000
+
+typedef struct {
+	uint16_t time;
+	uint16_t tag;
+	int16_t a;
+	int16_t b;
+} TraceRecord;
+
+static TraceRecord trace_buffer[TRACE_BUFFER_SIZE];
+static uint16_t trace_head;
+static uint16_t trace_tail;
+static uint16_t trace_dropped;
+static AppTimer *trace_timer;
+
+static void trace_flush(void *data)
+{
+	char line[2 + 16 * TRACE_FLUSH_BATCH];
+	TraceRecord *r;
+	int n;
+
+	trace_timer = NULL;
+	while (trace_tail != trace_head) {
+		line[0] = 'T';
+		for (n = 1; n < 1 + 16 * TRACE_FLUSH_BATCH && trace_tail != trace_head; n += 16, ++trace_tail) {
+			r = &trace_buffer[trace_tail % TRACE_BUFFER_SIZE];
+			snprintf(line + n, sizeof(line) - n, "%04x%04x%04x%04x", r->time, r->tag, (uint16_t)r->a, (uint16_t)r->b);
+		}
+		APP_LOG(APP_LOG_LEVEL_DEBUG, "%s", line);
+	}
+	if (trace_dropped > 0) {
+		APP_LOG(APP_LOG_LEVEL_DEBUG, "T dropped %u", trace_dropped);
+		trace_dropped = 0;
+	}
+}
+
+static void trace_record(int category, int line, int a, int b)
+{
+	TraceRecord *r;
+	time_t t;
+	uint16_t ms;
+	int bit = 0;
+
+	if ((uint16_t)(trace_head - trace_tail) == TRACE_BUFFER_SIZE) {
+		++trace_tail;
+		++trace_dropped;
+	}
+	while ((category >> bit) > 1) {
+		++bit;
+	}
+	time_ms(&t, &ms);
+	r = &trace_buffer[trace_head % TRACE_BUFFER_SIZE];
+	r->time = (uint16_t)(t * 1000 + ms);
+	r->tag = (uint16_t)(bit << 13 | (line & 0x1fff));
+	r->a = (int16_t)a;
+	r->b = (int16_t)b;
+	++trace_head;
+
+	if (trace_timer == NULL) {
+		trace_timer = app_timer_register(TRACE_FLUSH_DELAY, trace_flush, NULL);
+	} else if ((uint16_t)(trace_head - trace_tail) == TRACE_BUFFER_SIZE / 2) {
+		app_timer_reschedule(trace_timer, 0);
+	}
+}
+
+#define TRACE_EVENT(category, a, b) do { if ((TRACE) & (category)) { trace_record(category, __LINE__, a, b); } } while (0)
+#define TRACE_FLUSH() do { if (trace_timer != NULL) { app_timer_cancel(trace_timer); } trace_flush(NULL); } while (0)
+#else
+#define TRACE_EVENT(category, a, b) do { } while (0)
+#define TRACE_FLUSH() do { } while (0)
+#endif
+
+#define TRACE_RULES(a, b) TRACE_EVENT(TRACE_CAT_RULES, a, b)
+#define TRACE_SELECTION(a, b) TRACE_EVENT(TRACE_CAT_SELECTION, a, b)
+#define TRACE_DEAL(a, b) TRACE_EVENT(TRACE_CAT_DEAL, a, b)
+#define TRACE_PERSIST(a, b) TRACE_EVENT(TRACE_CAT_PERSIST, a, b)
+#define TRACE_RENDER(a, b) TRACE_EVENT(TRACE_CAT_RENDER, a, b)
+
+/******************************************************************************/
+/* Layout                                                                     */
+/******************************************************************************/
+/*
+	Screen positions for each platform, picked at compile time. Rectangular
+	screens (aplite, basalt, diorite) keep the original 144 pixel layout and
+	emery spreads the piles over 200 pixels. Round (chalk) has a shorter
+	header and insets each row so that it fits inside the circle: the top row
+	by LAYOUT_TOP_X, the tableau, which reaches lower, by LAYOUT_TABLEAU_X.
+	Both rows are a grid of TABLEAU_PILES columns spread evenly over the
+	screen between their insets: the stock takes the first column, the talon
+	fans out from the second and the foundations take the last ones. The
+	tables below are derived from these, so the draw code only indexes them,
+	and are checked against the rules variant at compile time. Sprite sizes
+	are fixed by the resources and shared by every platform.
+	LAYOUT_TABLEAU_Y is the top of the first face up card of a tableau pile;
+	LAYOUT_TABLEAU_SECOND_Y the top card in the compact view.
+*/
+#if defined(PBL_ROUND)
+#define LAYOUT_WIDTH 180
+#define LAYOUT_HEADER_HEIGHT 30
+#define LAYOUT_MODE_X 46
+#define LAYOUT_MODE_Y 14
+#define LAYOUT_SCORE_FRAME { { 72, 12 }, { 62, 17 } }
+#define LAYOUT_TOP_ROW_Y 33
+#define LAYOUT_TABLEAU_Y 86
+#define LAYOUT_TABLEAU_SECOND_Y 120
+#define LAYOUT_TOP_X 20
+#define LAYOUT_TABLEAU_X 28
+#elif defined(PBL_PLATFORM_EMERY)
+#define LAYOUT_WIDTH 200
+#define LAYOUT_HEADER_HEIGHT 19
+#define LAYOUT_MODE_X 4
+#define LAYOUT_MODE_Y 3
+#define LAYOUT_SCORE_FRAME { { 134, 0 }, { 62, 17 } }
+#define LAYOUT_TOP_ROW_Y 26
+#define LAYOUT_TABLEAU_Y 79
+#define LAYOUT_TABLEAU_SECOND_Y 113
+#define LAYOUT_TOP_X 4
+#define LAYOUT_TABLEAU_X 4
+#else
+#define LAYOUT_WIDTH 144
+#define LAYOUT_HEADER_HEIGHT 19
+#define LAYOUT_MODE_X 2
+#define LAYOUT_MODE_Y 3
+#define LAYOUT_SCORE_FRAME { { 80, 0 }, { 62, 17 } }
+#define LAYOUT_TOP_ROW_Y 26
+#define LAYOUT_TABLEAU_Y 79
+#define LAYOUT_TABLEAU_SECOND_Y 113
+#define LAYOUT_TOP_X 2
+#define LAYOUT_TABLEAU_X 2
+#endif
+
+#define CARD_WIDTH 19
+#define CARD_HEIGHT 33
+#define CARD_SIZE GSize(CARD_WIDTH, CARD_HEIGHT)
+#define BACK_SIZE GSize(17, 31)
+#define EDGE_SIZE GSize(19, 1)
+#define EDGE_SPACING 2
+#define SELECTOR_SIZE GSize(17, 3)
+#define MODE_SIZE GSize(22, 13)
+#define SYMBOL_SIZE GSize(13, 13) /* rank and suit */
+#define TALON_FAN 9 /* offset of each further talon card in draw three */
+#define SELECTOR_GAP (CARD_HEIGHT + 1) /* card top to the selector below it */
+#define LAYOUT_TOP_SELECTOR_Y (LAYOUT_TOP_ROW_Y + SELECTOR_GAP)
+#define LAYOUT_EMPTY_SELECTOR_Y LAYOUT_TABLEAU_SECOND_Y
+#define LAYOUT_COLUMN_X(inset, i) ((inset) + (LAYOUT_WIDTH - 2 * (inset) - CARD_WIDTH) / (TABLEAU_PILES - 1) * (i))
+#define LAYOUT_PILE_X(i) LAYOUT_COLUMN_X(LAYOUT_TABLEAU_X, i)
+#define LAYOUT_STOCK_X LAYOUT_COLUMN_X(LAYOUT_TOP_X, 0)
+#define LAYOUT_TALON_X LAYOUT_COLUMN_X(LAYOUT_TOP_X, 1)
+#define LAYOUT_FOUNDATION_PILE_X(i) LAYOUT_COLUMN_X(LAYOUT_TOP_X, TABLEAU_PILES - FOUNDATION_PILES + (i))
+
+#ifndef ARRAY_LENGTH
+#define ARRAY_LENGTH(array) (sizeof(array) / sizeof((array)[0]))
+#endif
+
+static const int16_t layout_talon_x[] = {
+	LAYOUT_TALON_X, LAYOUT_TALON_X + TALON_FAN, LAYOUT_TALON_X + 2 * TALON_FAN,
+};
+static const int16_t layout_foundation_x[] = {
+	LAYOUT_FOUNDATION_PILE_X(0), LAYOUT_FOUNDATION_PILE_X(1), LAYOUT_FOUNDATION_PILE_X(2), LAYOUT_FOUNDATION_PILE_X(3),
+};
+static const int16_t layout_tableau_x[] = {
+	LAYOUT_PILE_X(0), LAYOUT_PILE_X(1), LAYOUT_PILE_X(2), LAYOUT_PILE_X(3),
+	LAYOUT_PILE_X(4), LAYOUT_PILE_X(5), LAYOUT_PILE_X(6),
+};
+/* selector x for each pile; the talon selector follows the last showing card (layout_talon_x + 1) */
+static const int16_t layout_selector_x[] = {
+	LAYOUT_PILE_X(0) + 1, LAYOUT_PILE_X(1) + 1, LAYOUT_PILE_X(2) + 1, LAYOUT_PILE_X(3) + 1,
+	LAYOUT_PILE_X(4) + 1, LAYOUT_PILE_X(5) + 1, LAYOUT_PILE_X(6) + 1,
+	0,
+	/* centered under the foundations */
+	(LAYOUT_FOUNDATION_PILE_X(0) + LAYOUT_FOUNDATION_PILE_X(FOUNDATION_PILES - 1) + CARD_WIDTH - 17) / 2,
+};
+/* top of the edge drawn for the j-th face down card, stacking up from the pile */
+static const int16_t layout_edge_y[] = {
+	LAYOUT_TABLEAU_Y - 1 * EDGE_SPACING, LAYOUT_TABLEAU_Y - 2 * EDGE_SPACING, LAYOUT_TABLEAU_Y - 3 * EDGE_SPACING,
+	LAYOUT_TABLEAU_Y - 4 * EDGE_SPACING, LAYOUT_TABLEAU_Y - 5 * EDGE_SPACING, LAYOUT_TABLEAU_Y - 6 * EDGE_SPACING,
+};
+/* expanded view: top of the k-th face up card */
+static const int16_t layout_expanded_y[] = {
+	LAYOUT_TABLEAU_Y, LAYOUT_TABLEAU_Y + 1 * EXPANDED_CARD_SPACING, LAYOUT_TABLEAU_Y + 2 * EXPANDED_CARD_SPACING,
+	LAYOUT_TABLEAU_Y + 3 * EXPANDED_CARD_SPACING, LAYOUT_TABLEAU_Y + 4 * EXPANDED_CARD_SPACING,
+	LAYOUT_TABLEAU_Y + 5 * EXPANDED_CARD_SPACING, LAYOUT_TABLEAU_Y + 6 * EXPANDED_CARD_SPACING,
+	LAYOUT_TABLEAU_Y + 7 * EXPANDED_CARD_SPACING, LAYOUT_TABLEAU_Y + 8 * EXPANDED_CARD_SPACING,
+	LAYOUT_TABLEAU_Y + 9 * EXPANDED_CARD_SPACING, LAYOUT_TABLEAU_Y + 10 * EXPANDED_CARD_SPACING,
+	LAYOUT_TABLEAU_Y + 11 * EXPANDED_CARD_SPACING, LAYOUT_TABLEAU_Y + 12 * EXPANDED_CARD_SPACING,
+};
+
+/* the tables list one entry per pile (or card) of the rules variant; a variant with more needs longer ones */
+_Static_assert(ARRAY_LENGTH(layout_foundation_x) == FOUNDATION_PILES, "layout_foundation_x needs one entry per foundation");
+_Static_assert(ARRAY_LENGTH(layout_tableau_x) == TABLEAU_PILES, "layout_tableau_x needs one entry per tableau pile");
+_Static_assert(ARRAY_LENGTH(layout_selector_x) == PILE_FOUNDATIONS + 1, "layout_selector_x needs one entry per pile");
+_Static_assert(ARRAY_LENGTH(layout_edge_y) >= HIDDEN_MAX, "layout_edge_y needs one entry per face down card");
+_Static_assert(ARRAY_LENGTH(layout_expanded_y) >= SHOWING_MAX, "layout_expanded_y needs one entry per face up card");
+_Static_assert(LAYOUT_TALON_X + 2 * TALON_FAN + CARD_WIDTH <= LAYOUT_FOUNDATION_PILE_X(0), "talon overlaps the foundations");
+_Static_assert(LAYOUT_TABLEAU_Y - HIDDEN_MAX * EDGE_SPACING > LAYOUT_TOP_SELECTOR_Y + 3, "edges overlap the top row");
+
+/******************************************************************************/
+/* Drawing helpers                                                            */
+/******************************************************************************/
+static void draw_bitmap(GContext *ctx, const GBitmap *bitmap, GRect rect)
+{
+	// while repairing behind a moving card, only blits that touch the damaged area matter
+	if (repairing && (rect.origin.x >= flying_damage.origin.x + flying_damage.size.w
+		|| rect.origin.x + rect.size.w <= flying_damage.origin.x
+		|| rect.origin.y >= flying_damage.origin.y + flying_damage.size.h
+		|| rect.origin.y + rect.size.h <= flying_damage.origin.y)) {
+		return;
+	}
+	PROFILE_COUNT_BLIT();
+	graphics_draw_bitmap_in_rect(ctx, bitmap, rect);
+}
+
+/******************************************************************************/
+/* Replay                                                                     */
+/******************************************************************************/
+/*
+	Every game is recorded as its deal seed, rule settings, starting score
+	and a stream of one byte actions (values for Klondike; other variants
+	shift them with their pile count):
+	Value		Action
+	-----		------
+	0-71		move from pile src (0-7) to pile dest (0-8): src * 9 + dest
+	72		deal card from stock
+	73		automatically move to foundations
+	74-81		settings changed: 74 + draw_setting * 4 + fliplimit_setting
+	82		score reset
+	Moves, deals and automatic moves are recorded only when they change the
+	board; a deal from an exhausted stock or an automatic move with nothing
+	to move is not recorded. Replaying the actions through the game logic
+	reproduces the board exactly. If a game outgrows
+	REPLAY_MAX_ACTIONS the replay is marked truncated. The recording is saved
+	with the game state and can be exported to the log from the Tools menu;
+	tools/host/replay checks and benchmarks exported replays.
+
+	Exported replay format (integers little-endian):
+	Bytes	Description		Offset
+	-----	-----------		------
+	4	"SRP1"			0
+	4	deal seed		4
+	1	draw_setting at deal	8
+	1	fliplimit_setting	9
+	4	score after deal	10
+	2	action count		14
+	1	truncated		16
+	4	final score		17
+	1	win			21
+	4	final board_hash()	22
+	n	actions			26
+*/
+#define REPLAY_PILES (PILE_FOUNDATIONS + 1)
+#define REPLAY_MOVE(src, dest) ((src) * REPLAY_PILES + (dest))
+#define REPLAY_DEAL (REPLAY_PILES * (PILE_TALON + 1))
+#define REPLAY_AUTO_MOVE (REPLAY_DEAL + 1)
+#define REPLAY_SETTINGS(draw, fliplimit) (REPLAY_DEAL + 2 + (draw) * 4 + (fliplimit))
+#define REPLAY_RESET_SCORE (REPLAY_DEAL + 10)
+#define REPLAY_KEYS 3
+#define REPLAY_MAX_ACTIONS (REPLAY_KEYS * PERSIST_DATA_MAX_LENGTH)
+#define REPLAY_HEADER_SIZE 26
+
+static int32_t replay_seed;
+static unsigned char replay_draw_setting;
+static unsigned char replay_fliplimit_setting;
+static int32_t replay_start_score;
+static uint16_t replay_count;
+static bool replay_truncated;
+static bool replay_valid;
+static unsigned char replay_actions[REPLAY_MAX_ACTIONS];
+
+/* Start recording a new game; replay_seed has been set by the shuffle */
+static void replay_start()
+{
+	replay_draw_setting = (unsigned char)draw_setting;
+	replay_fliplimit_setting = (unsigned char)fliplimit_setting;
+	replay_start_score = score;
+	replay_count = 0;
+	replay_truncated = false;
+	replay_valid = true;
+}
+
+static void history_count_action(int action);
+
+static void replay_record(int action)
+{
+	history_count_action(action);
+	if (replay_count < REPLAY_MAX_ACTIONS) {
+		replay_actions[replay_count++] = (unsigned char)action;
+	} else {
+		replay_truncated = true;
+	}
+}
+
+/* FNV-1a over everything that defines the board */
+static uint32_t board_hash()
+{
+	uint32_t h = 2166136261u;
+	int i;
+	int j;
+
+#define BOARD_HASH_ADD(v) (h = (h ^ (uint8_t)(v)) * 16777619u)
+	BOARD_HASH_ADD(stock_count);
+	BOARD_HASH_ADD(talon);
+	BOARD_HASH_ADD(talon_showing);
+	BOARD_HASH_ADD(flips);
+	for (i = 0; i < stock_count; ++i) {
+		BOARD_HASH_ADD(stock[i]);
+	}
+	for (i = PILE_FOUNDATION_LEFT; i <= PILE_FOUNDATION_RIGHT; ++i) {
+		BOARD_HASH_ADD(foundation[i]);
+	}
+	for (i = PILE_TABLEAU_LEFT; i <= PILE_TABLEAU_RIGHT; ++i) {
+		BOARD_HASH_ADD(hidden_count[i]);
+		BOARD_HASH_ADD(tableau_count[i]);
+		for (j = 0; j < tableau_count[i]; ++j) {
+			BOARD_HASH_ADD(tableau[i][j]);
+		}
+	}
+#undef BOARD_HASH_ADD
+	return h;
+}
+
+static void put_le(unsigned char *p, uint32_t v, int bytes)
+{
+	int i;
+
+	for (i = 0; i < bytes; ++i) {
+		p[i] = (unsigned char)(v >> (8 * i));
+	}
+}
+
+/* Write the replay header for the current board into buf */
+static void replay_header(unsigned char *buf)
+{
+	memcpy(buf, "SRP1", 4);
+	put_le(buf + 4, (uint32_t)replay_seed, 4);
+	buf[8] = replay_draw_setting;
+	buf[9] = replay_fliplimit_setting;
+	put_le(buf + 10, (uint32_t)replay_start_score, 4);
+	put_le(buf + 14, replay_count, 2);
+	buf[16] = (unsigned char)replay_truncated;
+	put_le(buf + 17, (uint32_t)score, 4);
+	buf[21] = (unsigned char)win;
+	put_le(buf + 22, board_hash(), 4);
+}
+
+/* Log the replay as "RPL <hex>" lines of 32 bytes, ending with "RPL end" */
+static void replay_export()
+{
+	unsigned char header[REPLAY_HEADER_SIZE];
+	char line[4 + 2 * 32 + 1];
+	int size;
+	int i;
+	int n;
+
+	if (!replay_valid) {
+		APP_LOG(APP_LOG_LEVEL_INFO, "RPL none");
+		return;
+	}
+	replay_header(header);
+	size = REPLAY_HEADER_SIZE + replay_count;
+	for (i = 0; i < size; ) {
+		memcpy(line, "RPL ", 4);
+		for (n = 4; n < 4 + 2 * 32 && i < size; n += 2, ++i) {
+			snprintf(line + n, 3, "%02x", (i < REPLAY_HEADER_SIZE) ? header[i] : replay_actions[i - REPLAY_HEADER_SIZE]);
+		}
+		line[n] = '\0';
+		APP_LOG(APP_LOG_LEVEL_INFO, "%s", line);
+	}
+	APP_LOG(APP_LOG_LEVEL_INFO, "RPL end");
+}
+
+/******************************************************************************/
+/* Game History                                                               */
+/******************************************************************************/
+/*
+	Every finished game, won or abandoned by Re-deal after at least one move,
+	becomes a record in a ring of HISTORY_CAPACITY records. The ring is
+	sharded over HISTORY_SHARDS persistent keys after the header key, one
+	PERSIST_DATA_MAX_LENGTH shard each; when it is full the oldest record is
+	overwritten. The header keeps running totals and streaks, updated as each
+	game ends, so the statistics screen reads the header and only the last few
+	records. A finished game is held in memory and written with the header a
+	few seconds later, or on exit, so no move waits for storage.
+	Moves are the deals, moves and automatic moves the replay records, so a
+	press that changes nothing does not count; time counts the gaps between
+	them, each capped at HISTORY_IDLE_SECONDS so that a game left open does
+	not count.
+
+	Header format (integers little-endian):
+	Bytes	Description		Offset
+	-----	-----------		------
+	4	"SHS1"			0
+	2	oldest record		4
+	2	records			6
+	4	games			8
+	4	games won		12
+	2	streak (+won, -lost)	16
+	2	longest winning streak	18
+	2	longest losing streak	20
+	4	seconds played		22
+	4	current game deal seed	26
+	2	current game moves	30
+	2	current game seconds	32
+	1	current game recorded	34
+
+	Record format:
+	Bytes	Description		Offset
+	-----	-----------		------
+	4	deal seed		0
+	1	draw | fliplimit << 1	4
+		| won << 3
+	1	cards on foundations	5
+	2	moves			6
+	2	seconds			8
+	4	final score		10
+*/
+#define HISTORY_HEADER_SIZE 35
+#define HISTORY_RECORD_SIZE 14
+#define HISTORY_SHARDS 6
+#define HISTORY_SHARD_RECORDS (PERSIST_DATA_MAX_LENGTH / HISTORY_RECORD_SIZE)
+#define HISTORY_CAPACITY (HISTORY_SHARDS * HISTORY_SHARD_RECORDS)
+#define HISTORY_PENDING 4
+#define HISTORY_FLUSH_DELAY 5000
+#define HISTORY_IDLE_SECONDS 60
+#define HISTORY_RECENT 5
+
+static bool history_loaded;
+static uint16_t history_oldest;
+static uint16_t history_records;
+static uint32_t history_games;
+static uint32_t history_wins;
+static int16_t history_streak;
+static uint16_t history_best_streak;
+static uint16_t history_worst_streak;
+static uint32_t history_seconds;
+static unsigned char history_pending[HISTORY_PENDING][HISTORY_RECORD_SIZE];
+static int history_pending_count;
+static unsigned char history_shard[PERSIST_DATA_MAX_LENGTH];
+static AppTimer *history_timer;
+static char history_text[384];
+
+/* Read the header; the current game counters carry over if it is the saved game */
+static void history_load()
+{
+	unsigned char header[HISTORY_HEADER_SIZE];
+	int32_t current_seed;
+
+	if (history_loaded) {
+		return;
+	}
+	history_loaded = true;
+	if (persist_read_data(PERSIST_KEY_HISTORY, header, HISTORY_HEADER_SIZE) != HISTORY_HEADER_SIZE
+			|| memcmp(header, "SHS1", 4) != 0) {
+		return;
+	}
+	memcpy((char*)&history_oldest, header + 4, 2);
+	memcpy((char*)&history_records, header + 6, 2);
+	memcpy((char*)&history_games, header + 8, 4);
+	memcpy((char*)&history_wins, header + 12, 4);
+	memcpy((char*)&history_streak, header + 16, 2);
+	memcpy((char*)&history_best_streak, header + 18, 2);
+	memcpy((char*)&history_worst_streak, header + 20, 2);
+	memcpy((char*)&history_seconds, header + 22, 4);
+	memcpy((char*)&current_seed, header + 26, 4);
+	if (history_oldest >= HISTORY_CAPACITY || history_records > HISTORY_CAPACITY) {
+		history_oldest = 0;
+		history_records = 0;
+	}
+	if (replay_valid && current_seed == replay_seed) {
+		memcpy((char*)&game_moves, header + 30, 2);
+		memcpy((char*)&game_seconds, header + 32, 2);
+		game_recorded = header[34];
+	}
+}
+
+/* Append the pending records to the ring and write the header */
+static void history_flush()
+{
+	unsigned char header[HISTORY_HEADER_SIZE];
+	int shard = -1;
+	int index;
+	int i;
+
+	if (!history_loaded) {
+		return;
+	}
+	for (i = 0; i < history_pending_count; ++i) {
+		if (history_records < HISTORY_CAPACITY) {
+			index = (history_oldest + history_records++) % HISTORY_CAPACITY;
+		} else {
+			index = history_oldest;
+			history_oldest = (history_oldest + 1) % HISTORY_CAPACITY;
+		}
+		if (index / HISTORY_SHARD_RECORDS != shard) {
+			if (shard >= 0) {
+				persist_write_data(PERSIST_KEY_HISTORY + 1 + shard, history_shard, PERSIST_DATA_MAX_LENGTH);
+			}
+			shard = index / HISTORY_SHARD_RECORDS;
+			memset(history_shard, 0, sizeof(history_shard));
+			persist_read_data(PERSIST_KEY_HISTORY + 1 + shard, history_shard, PERSIST_DATA_MAX_LENGTH);
+		}
+		memcpy(history_shard + index % HISTORY_SHARD_RECORDS * HISTORY_RECORD_SIZE, history_pending[i], HISTORY_RECORD_SIZE);
+	}
+	if (shard >= 0) {
+		persist_write_data(PERSIST_KEY_HISTORY + 1 + shard, history_shard, PERSIST_DATA_MAX_LENGTH);
+	}
+	history_pending_count = 0;
+
+	memcpy(header, "SHS1", 4);
+	put_le(header + 4, history_oldest, 2);
+	put_le(header + 6, history_records, 2);
+	put_le(header + 8, history_games, 4);
+	put_le(header + 12, history_wins, 4);
+	put_le(header + 16, (uint16_t)history_streak, 2);
+	put_le(header + 18, history_best_streak, 2);
+	put_le(header + 20, history_worst_streak, 2);
+	put_le(header + 22, history_seconds, 4);
+	put_le(header + 26, (uint32_t)replay_seed, 4);
+	put_le(header + 30, game_moves, 2);
+	put_le(header + 32, game_seconds, 2);
+	header[34] = (unsigned char)game_recorded;
+	persist_write_data(PERSIST_KEY_HISTORY, header, HISTORY_HEADER_SIZE);
+}
+
+static void history_flush_timer(void *data)
+{
+	history_timer = NULL;
+	history_flush();
+}
+
+/* Count a deal, move or automatic move towards the current game */
+static void history_count_action(int action)
+{
+	time_t now = time(NULL);
+	uint32_t gap;
+
+	if (action > REPLAY_AUTO_MOVE) {
+		return;
+	}
+	if (game_moves < UINT16_MAX) {
+		++game_moves;
+	}
+	if (game_action_time != 0 && now > game_action_time) {
+		gap = (now - game_action_time < HISTORY_IDLE_SECONDS) ? (uint32_t)(now - game_action_time) : HISTORY_IDLE_SECONDS;
+		game_seconds = (game_seconds + gap < UINT16_MAX) ? game_seconds + gap : UINT16_MAX;
+	}
+	game_action_time = now;
+}
+
+/* Record the current game once, when it is won or given up; storage is written later */
+static void history_finish_game()
+{
+	unsigned char *r;
+	int cards = 0;
+	int i;
+
+	history_load();
+	if (game_recorded || game_moves == 0) {
+		return;
+	}
+	game_recorded = true;
+	if (history_pending_count == HISTORY_PENDING) {
+		history_flush();
+	}
+	for (i = PILE_FOUNDATION_LEFT; i <= PILE_FOUNDATION_RIGHT; ++i) {
+		cards += (foundation[i] >> 2) + 1;
+	}
+	r = history_pending[history_pending_count++];
+	put_le(r, (uint32_t)replay_seed, 4);
+	r[4] = (unsigned char)(replay_draw_setting | replay_fliplimit_setting << 1 | win << 3);
+	r[5] = (unsigned char)cards;
+	put_le(r + 6, game_moves, 2);
+	put_le(r + 8, game_seconds, 2);
+	put_le(r + 10, (uint32_t)score, 4);
+
+	++history_games;
+	history_seconds += game_seconds;
+	if (win) {
+		++history_wins;
+		history_streak = (history_streak > 0) ? history_streak + 1 : 1;
+		if (history_streak > history_best_streak) {
+			history_best_streak = history_streak;
+		}
+	} else {
+		history_streak = (history_streak < 0) ? history_streak - 1 : -1;
+		if (-history_streak > history_worst_streak) {
+			history_worst_streak = -history_streak;
+		}
+	}
+	if (history_timer == NULL) {
+		history_timer = app_timer_register(HISTORY_FLUSH_DELAY, history_flush_timer, NULL);
+	}
+}
+
+/* Format the totals and the last few games into history_text */
+static const char *history_report()
+{
+	unsigned char *r;
+	int n = 0;
+	int i;
+	int index;
+	int shard = -1;
+	uint16_t moves;
+	uint16_t seconds;
+
+	// a menu action: a good time to write any finished game
+	history_load();
+	if (history_timer != NULL) {
+		app_timer_cancel(history_timer);
+		history_timer = NULL;
+	}
+	history_flush();
+
+	n += snprintf(history_text + n, sizeof(history_text) - n, "Games: %lu\nWon: %lu (%lu%%)\n",
+		(unsigned long)history_games, (unsigned long)history_wins,
+		(unsigned long)(history_games ? history_wins * 100 / history_games : 0));
+	n += snprintf(history_text + n, sizeof(history_text) - n, "Streak: %d %s\nBest: %u won, %u lost\nPlayed: %luh %02lum\n",
+		(history_streak < 0) ? -history_streak : history_streak, (history_streak < 0) ? "lost" : "won",
+		history_best_streak, history_worst_streak,
+		(unsigned long)(history_seconds / 3600), (unsigned long)(history_seconds / 60 % 60));
+	for (i = 0; i < HISTORY_RECENT && i < history_records; ++i) {
+		index = (history_oldest + history_records - 1 - i) % HISTORY_CAPACITY;
+		if (index / HISTORY_SHARD_RECORDS != shard) {
+			shard = index / HISTORY_SHARD_RECORDS;
+			memset(history_shard, 0, sizeof(history_shard));
+			persist_read_data(PERSIST_KEY_HISTORY + 1 + shard, history_shard, PERSIST_DATA_MAX_LENGTH);
+		}
+		r = history_shard + index % HISTORY_SHARD_RECORDS * HISTORY_RECORD_SIZE;
+		memcpy((char*)&moves, r + 6, 2);
+		memcpy((char*)&seconds, r + 8, 2);
+		n += snprintf(history_text + n, sizeof(history_text) - n, "%s%s %d/%d, %u moves, %u:%02u\n",
+			(i == 0) ? "\nRecent:\n" : "", (r[4] & 8) ? "Won" : "Lost", r[5], CARDS, moves, seconds / 60, seconds % 60);
+		if (n >= (int)sizeof(history_text)) {
+			break;
+		}
+	}
+	return history_text;
+}
 
 /******************************************************************************/
 /* Game Logic                                                                 */
 /******************************************************************************/
 static int get_source_card()
 {
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "get_source_card, source=%i, draw_setting=%i, stock_count=%i, talon=%i, talon_showing=%i", source, draw_setting, stock_count, talon, talon_showing);
+	TRACE_RULES(source, stock_count);
 	if (source < 0 || source >= PILE_FOUNDATIONS) {
 		return -1;
 	}
@@ -130,7 +1158,7 @@ static void tableau_flip_top_card()
 
 static void remove_source_card()
 {
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "remove_source_card, start, draw_setting=%i, stock_count=%i, talon=%i, talon_showing=%i", draw_setting, stock_count, talon, talon_showing);
+	TRACE_RULES(source, stock_count);
 	int i;
 
 	if (source == PILE_TALON) {
@@ -149,34 +1177,32 @@ static void remove_source_card()
 		--tableau_count[source];
 		tableau_flip_top_card();
 	}
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "remove_source_card, end, draw_setting=%i, stock_count=%i, talon=%i, talon_showing=%i", draw_setting, stock_count, talon, talon_showing);
+	TRACE_RULES(talon, talon_showing);
 }
 
 static bool tableau_rules_met(int src_rank, int src_suit, bool king_allowed_on_empty)
 {
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "tableau_rules_met, start, src_rank=%i, src_suit=%i, kaoe=%i", src_rank, src_suit, king_allowed_on_empty);
+	TRACE_RULES(src_rank * 4 + src_suit, king_allowed_on_empty);
 	int dest_card;
 	int dest_rank;
 	int dest_suit;
+	PROFILE_COUNT_RULE();
 	if (tableau_count[selection] > 0) {
 		dest_card = tableau[selection][tableau_count[selection] - 1];
 		dest_rank = dest_card >> 2;
-		//APP_LOG(APP_LOG_LEVEL_DEBUG, "tableau_rules_met, tc[s]>0, dest_card=%i, dest_rank=%i", dest_card, dest_rank);
-		if (src_rank == dest_rank - 1) {
-			//APP_LOG(APP_LOG_LEVEL_DEBUG, "tableau_rules_met, sr==dr-1");
-			dest_suit = dest_card % 4;
-			if ((src_suit >> 1) != (dest_suit >> 1)) {
-				//APP_LOG(APP_LOG_LEVEL_DEBUG, "tableau_rules_met, end [A]. true");
-				return true;
-			}
+		dest_suit = dest_card % 4;
+		TRACE_RULES(dest_card, dest_rank);
+		if (TABLEAU_BUILDS(src_rank, src_suit, dest_rank, dest_suit)) {
+			TRACE_RULES(selection, true);
+			return true;
 		}
 	} else {
-		if (src_rank == 12 && king_allowed_on_empty) {
-			//APP_LOG(APP_LOG_LEVEL_DEBUG, "tableau_rules_met, end [B]. true");
+		if (TABLEAU_EMPTY_TAKES(src_rank) && king_allowed_on_empty) {
+			TRACE_RULES(selection, true);
 			return true;
 		}
 	}
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "tableau_rules_met, end [C]. false");
+	TRACE_RULES(selection, false);
 	return false;
 }
 
@@ -187,41 +1213,38 @@ static bool multiple_cards_are_showing(int i)
 
 static bool can_move_single_card_to_tableau()
 {
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "can_move_single_card_to_tableau, start");
+	TRACE_RULES(source, selection);
 	int src_card;
 	int src_rank;
 	int src_suit;
 
 	if (selection == source) {
-		//APP_LOG(APP_LOG_LEVEL_DEBUG, "can_move_single_card_to_tableau, end [A], sel==src. false");
 		return false;
 	}
 	src_card = get_source_card();
 	if (src_card < 0) {
-		//APP_LOG(APP_LOG_LEVEL_DEBUG, "can_move_single_card_to_tableau, end [B], invalid src_card. false");
+		TRACE_RULES(src_card, 0);
 		return false;
 	}
 	src_rank = src_card >> 2;
 	src_suit = src_card % 4;
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "can_move_single_card_to_tableau, end [C] (kinda)");
 	return tableau_rules_met(src_rank, src_suit, true);
 }
 
 static bool can_move_pile_to_tableau()
 {
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "can_move_pile_to_tableau, start");
+	TRACE_RULES(source, selection);
 	int src_card;
 	int src_rank;
 	int src_suit;
 
 	if (selection == source || source > PILE_TABLEAU_RIGHT || !multiple_cards_are_showing(source)) {
-		//APP_LOG(APP_LOG_LEVEL_DEBUG, "can_move_pile_to_tableau, end [A]. false, selection=%i, source=%i", selection, source);
+		TRACE_RULES(selection, source);
 		return false;
 	}
 	src_card = tableau[source][hidden_count[source]];
 	src_rank = src_card >> 2;
 	src_suit = src_card % 4;
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "can_move_pile_to_tableau, end [B] (kinda)");
 	return tableau_rules_met(src_rank, src_suit, hidden_count[source] > 0);
 }
 
@@ -230,7 +1253,7 @@ static bool can_move_to_tableau()
 	return (can_move_single_card_to_tableau() || can_move_pile_to_tableau());
 }
 
-static void move_to_tableau()
+static bool move_to_tableau()
 {
 	// move card or pile to tableau
 	int i;
@@ -248,12 +1271,15 @@ static void move_to_tableau()
 		}
 		tableau_count[source] = hidden_count[source];
 		tableau_flip_top_card();
+	} else {
+		return false;
 	}
+	return true;
 }
 
 static int can_move_to_foundations()
 {
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "can_move_to_foundations, start");
+	TRACE_RULES(source, 0);
 	int i;
 	int src_card;
 	int src_rank;
@@ -262,63 +1288,59 @@ static int can_move_to_foundations()
 	int dest_rank;
 	int dest_suit;
 
+	PROFILE_COUNT_RULE();
 	src_card = get_source_card();
 	if (src_card < 0) {
-		//APP_LOG(APP_LOG_LEVEL_DEBUG, "can_move_to_foundations, end [A]. 4 (false)");
+		TRACE_RULES(src_card, 0);
 		return PILE_FOUNDATION_RIGHT + 1;
 	}
 	src_rank = src_card >> 2;
 	src_suit = src_card % 4;
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "can_move_to_foundations, src_rank=%i, src_suit=%i", src_rank, src_suit);
+	TRACE_RULES(src_rank, src_suit);
 
 	for (i = PILE_FOUNDATION_LEFT; i <= PILE_FOUNDATION_RIGHT; ++i) {
 		dest_card = foundation[i];
-		//APP_LOG(APP_LOG_LEVEL_DEBUG, "can_move_to_foundations, i=%i, dest_card=%i", i, dest_card);
+		TRACE_RULES(i, dest_card);
 		if (dest_card == -1) {
 			if (src_rank != 0) {
-				//APP_LOG(APP_LOG_LEVEL_DEBUG, "can_move_to_foundations, continue [A]");
 				continue;
 			}
-			//APP_LOG(APP_LOG_LEVEL_DEBUG, "can_move_to_foundations, break [A]");
 			break;
 		}
 		dest_suit = dest_card % 4;
-		//APP_LOG(APP_LOG_LEVEL_DEBUG, "can_move_to_foundations, dest_suit=%i", dest_suit);
+		TRACE_RULES(dest_suit, src_suit);
 		if (src_suit != dest_suit) {
-			//APP_LOG(APP_LOG_LEVEL_DEBUG, "can_move_to_foundations, continue [B]");
 			continue;
 		}
 		dest_rank = dest_card >> 2;
-		//APP_LOG(APP_LOG_LEVEL_DEBUG, "can_move_to_foundations, dest_rank=%i", dest_rank);
+		TRACE_RULES(dest_rank, src_rank);
 		if (src_rank == dest_rank + 1) {
-			//APP_LOG(APP_LOG_LEVEL_DEBUG, "can_move_to_foundations, break [B]");
 			break;
 		}
 	}
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "can_move_to_foundations, end [B]. i=%i", i);
+	TRACE_RULES(i, 0);
 	return i;
 }
 
 static bool move_to_foundation()
 {
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "move_to_foundation, start");
+	TRACE_RULES(source, score);
 	// move card to foundation
 	int i;
 	bool success = false;
 
 	i = can_move_to_foundations();
 	if (i <= PILE_FOUNDATION_RIGHT) {
-		//APP_LOG(APP_LOG_LEVEL_DEBUG, "move_to_foundation, i=%i", i);
+		TRACE_RULES(i, 0);
 		success = true;
 		foundation[i] = get_source_card();
-		//APP_LOG(APP_LOG_LEVEL_DEBUG, "move_to_foundation, foundation[i]=%i", foundation[i]);
+		TRACE_RULES(foundation[i], 0);
 		remove_source_card();
-		//APP_LOG(APP_LOG_LEVEL_DEBUG, "move_to_foundation, removed source card");
 		score += 5;
 
 		// vibrate on win
 		for (i = PILE_FOUNDATION_LEFT; i <= PILE_FOUNDATION_RIGHT; ++i) {
-			if (foundation[i] < 48) {
+			if (foundation[i] >> 2 < KING) {
 				break;
 			}
 		}
@@ -327,30 +1349,50 @@ static bool move_to_foundation()
 			win = true;
 		}
 	}
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "move_to_foundation, end. success=%i", success);
+	TRACE_RULES(success, 0);
 	return success;
 }
 
-static void automatically_move_to_foundations()
+/*
+	Automatic moves sweep the tableau left to right, moving every card that
+	fits a foundation, and sweep again until a whole sweep moves nothing. They
+	are taken one at a time so that each move can be animated.
+*/
+static void auto_move_start()
 {
-	int i;
-	bool success;
-	do {
-		success = false;
-		for (i = PILE_TABLEAU_LEFT; i <= PILE_TABLEAU_RIGHT; ++i) {
-			if (tableau_count[i] > 0) {
-				source = i;
-				if (move_to_foundation()) {
-					success = true;
-				}
+	auto_move_pile = PILE_TABLEAU_LEFT;
+	auto_move_success = false;
+}
+
+/* The next tableau pile whose top card goes to a foundation, or -1 when done */
+static int auto_move_next_pile()
+{
+	while (true) {
+		if (auto_move_pile > PILE_TABLEAU_RIGHT) {
+			if (!auto_move_success) {
+				return -1;
 			}
+			auto_move_pile = PILE_TABLEAU_LEFT;
+			auto_move_success = false;
 		}
-	} while (success);
+		if (tableau_count[auto_move_pile] > 0) {
+			source = auto_move_pile;
+			if (can_move_to_foundations() <= PILE_FOUNDATION_RIGHT) {
+				auto_move_success = true;
+				return auto_move_pile++;
+			}
+		}
+		++auto_move_pile;
+	}
 }
 
-static void deal_card_from_stock()
+/* Returns true if the talon changed */
+static bool deal_card_from_stock()
 {
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "deal_card_from_stock, start, draw_setting=%i, stock_count=%i, talon=%i, talon_showing=%i, fliplimit_setting=%i", draw_setting, stock_count, talon, talon_showing, fliplimit_setting);
+	int old_talon = talon;
+	int old_showing = talon_showing;
+
+	TRACE_DEAL(stock_count, talon);
 	if (stock_count > talon_showing + 1) {
 		if (talon + talon_showing + 1 == stock_count) {
 			if ((fliplimit_setting == 0) || (fliplimit_setting == 2 && flips < 1) || (fliplimit_setting == 3 && flips < 3)) {
@@ -368,7 +1410,8 @@ static void deal_card_from_stock()
 		}
 
 	}
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "deal_card_from_stock, end, draw_setting=%i, stock_count=%i, talon=%i, talon_showing=%i", draw_setting, stock_count, talon, talon_showing);
+	TRACE_DEAL(talon, talon_showing);
+	return talon != old_talon || talon_showing != old_showing;
 }
 
 /******************************************************************************/
@@ -376,35 +1419,34 @@ static void deal_card_from_stock()
 /******************************************************************************/
 static bool source_pile_is_valid()
 {
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "source_pile_is_valid, start");
+	TRACE_SELECTION(selection, mode);
 	int saved_selection = selection;
 
 	if (selection == PILE_TALON) {
-		//APP_LOG(APP_LOG_LEVEL_DEBUG, "source_pile_is_valid, end [A]. true, selection=%i", selection);
+		TRACE_SELECTION(selection, 0);
 		return true;
 	}
 	source = selection;
 	if (can_move_to_foundations() <= PILE_FOUNDATION_RIGHT) {
-		//APP_LOG(APP_LOG_LEVEL_DEBUG, "source_pile_is_valid, can_move_to_foundations, end [B]. true, selection=%i", selection);
+		TRACE_SELECTION(selection, 0);
 		return true;
 	}
 	for (selection = PILE_TABLEAU_LEFT; selection <= PILE_TABLEAU_RIGHT; ++selection) {
-		//APP_LOG(APP_LOG_LEVEL_DEBUG, "source_pile_is_valid, selection=%i", selection);
+		TRACE_SELECTION(selection, 0);
 		if (can_move_to_tableau()) {
-			//APP_LOG(APP_LOG_LEVEL_DEBUG, "source_pile_is_valid, can_move_to_tableau");
 			selection = saved_selection;
-			//APP_LOG(APP_LOG_LEVEL_DEBUG, "source_pile_is_valid, end [C]. true, selection=%i", selection);
+			TRACE_SELECTION(selection, 0);
 			return true;
 		}
 	}
 	selection = saved_selection;
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "source_pile_is_valid, end [D]. false, selection=%i", selection);
+	TRACE_SELECTION(selection, 0);
 	return false;
 }
 
 static void select_talon()
 {
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "select_talon, start");
+	TRACE_SELECTION(selection, stock_count);
 	int i;
 
 	if (win) {
@@ -412,81 +1454,165 @@ static void select_talon()
 	}
 	mode = MODE_SELECT_SRC;
 	if (stock_count < 1) {
-		//APP_LOG(APP_LOG_LEVEL_DEBUG, "select_talon, stock_count=%i", stock_count);
+		TRACE_SELECTION(stock_count, 0);
 		for (i = PILE_TABLEAU_LEFT; i <= PILE_TABLEAU_RIGHT; ++i) {
-			//APP_LOG(APP_LOG_LEVEL_DEBUG, "select_talon, i=%i", i);
+			TRACE_SELECTION(i, 0);
 			selection = i;
 			if (source_pile_is_valid()) {
-				//APP_LOG(APP_LOG_LEVEL_DEBUG, "select_talon, source_pile_is_valid");
-				//APP_LOG(APP_LOG_LEVEL_DEBUG, "select_talon, end [A]. selection=%i", selection);
+				TRACE_SELECTION(selection, 0);
 				return;
 			}
 		}
 	}
 	selection = PILE_TALON;
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "select_talon, end [B]. selection=%i", selection);
+	TRACE_SELECTION(selection, 0);
 }
 
 static bool destination_pile_is_valid()
 {
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "destination_pile_is_valid, start");
+	TRACE_SELECTION(selection, source);
 	if (selection == PILE_FOUNDATIONS) {
-		//APP_LOG(APP_LOG_LEVEL_DEBUG, "destination_pile_is_valid, end [A] (kinda)");
 		return (can_move_to_foundations() <= PILE_FOUNDATION_RIGHT);
 	}
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "destination_pile_is_valid, end [B] (kinda)");
 	return can_move_to_tableau();
 }
 
+/*
+	Destinations are offered best first. When a source is chosen, every legal
+	destination is ranked once: a foundation move that cannot strand a lower
+	card that builds on it, then any move that turns up a hidden card, then a
+	card (in Klondike, a king or king pile) into an empty pile, then the rest,
+	and last a whole pile moved from one empty pile to another. The best is
+	preselected and Up walks the ranking; past the last one the move is
+	abandoned. Ties keep the old order: foundations, then tableau left to
+	right.
+*/
+#define RANK_SAFE_FOUNDATION 0
+#define RANK_REVEALS 1
+#define RANK_TO_EMPTY 2
+#define RANK_OTHER 3
+#define RANK_POINTLESS 4
+
+static int destination_order[TABLEAU_PILES + 1];
+static int destination_count;
+static int destination_next;
+
+/* true if every card that TABLEAU_BUILDS on card is already on a foundation */
+static bool foundation_move_is_safe(int card)
+{
+	int rank = card >> 2;
+	int top[SUITS];
+	int i;
+
+	for (i = 0; i < SUITS; ++i) {
+		top[i] = -1;
+	}
+	for (i = PILE_FOUNDATION_LEFT; i <= PILE_FOUNDATION_RIGHT; ++i) {
+		if (foundation[i] >= 0 && foundation[i] >> 2 > top[foundation[i] % 4]) {
+			top[foundation[i] % 4] = foundation[i] >> 2;
+		}
+	}
+	for (i = 0; i < SUITS; ++i) {
+		if (rank > 1 && TABLEAU_BUILDS(rank - 1, i, rank, card % 4) && top[i] < rank - 1) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Rank of the legal move from source to selection */
+static int destination_rank()
+{
+	bool whole_pile;
+
+	if (selection == PILE_FOUNDATIONS && foundation_move_is_safe(get_source_card())) {
+		return RANK_SAFE_FOUNDATION;
+	}
+	if (source == PILE_TALON) {
+		whole_pile = false;
+	} else if (selection != PILE_FOUNDATIONS && !can_move_single_card_to_tableau()) {
+		whole_pile = true;
+	} else {
+		whole_pile = (tableau_count[source] == hidden_count[source] + 1);
+	}
+	if (whole_pile && hidden_count[source] > 0) {
+		return RANK_REVEALS;
+	}
+	if (selection != PILE_FOUNDATIONS && tableau_count[selection] == 0) {
+		return whole_pile ? RANK_POINTLESS : RANK_TO_EMPTY;
+	}
+	return RANK_OTHER;
+}
+
+/* Rank the legal destinations for source and select the best one */
+static void select_first_destination()
+{
+	int rank[TABLEAU_PILES + 1];
+	int pile;
+	int r;
+	int i;
+
+	destination_count = 0;
+	for (pile = PILE_TABLEAU_LEFT - 1; pile <= PILE_TABLEAU_RIGHT; ++pile) {
+		selection = (pile < PILE_TABLEAU_LEFT) ? PILE_FOUNDATIONS : pile;
+		if (!destination_pile_is_valid()) {
+			continue;
+		}
+		// insert after every destination ranked the same or better
+		r = destination_rank();
+		for (i = destination_count; i > 0 && rank[i - 1] > r; --i) {
+			rank[i] = rank[i - 1];
+			destination_order[i] = destination_order[i - 1];
+		}
+		rank[i] = r;
+		destination_order[i] = selection;
+		++destination_count;
+	}
+	if (destination_count == 0) {
+		mode = MODE_SELECT_SRC;
+		select_talon();
+		return;
+	}
+	selection = destination_order[0];
+	destination_next = 1;
+}
+
 static void select_next_valid_pile()
 {
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "select_next_valid_pile, start");
-	int wrapped = -1;
+	TRACE_SELECTION(selection, mode);
 
 	if (mode == MODE_SELECT_SRC) {
 		while (true) {
-			//APP_LOG(APP_LOG_LEVEL_DEBUG, "snvp [0], while. selection=%i", selection);
+			TRACE_SELECTION(selection, 0);
 			++selection;
 			if (selection >= PILE_FOUNDATIONS) {
 				selection = PILE_TABLEAU_LEFT;
 			}
-			//APP_LOG(APP_LOG_LEVEL_DEBUG, "snvp [0]. selection=%i", selection);
+			TRACE_SELECTION(selection, 0);
 			if (source_pile_is_valid()) {
-				//APP_LOG(APP_LOG_LEVEL_DEBUG, "snvp [0]. source_pile_is_valid");
 				if (selection == PILE_TALON) {
-					//APP_LOG(APP_LOG_LEVEL_DEBUG, "snvp [0]. select_talon");
 					select_talon();
 				}
 				break;
 			}
 		}
 	} else {
+		// walk the ranking made by select_first_destination
 		while (true) {
-			//APP_LOG(APP_LOG_LEVEL_DEBUG, "snvp [1], while. selection=%i", selection);
-			++selection;
-			if (selection == PILE_TALON) {
-				selection = PILE_FOUNDATIONS;
-			}
-			if (selection > PILE_FOUNDATIONS) {
-				selection = PILE_TABLEAU_LEFT;
-			}
-			//APP_LOG(APP_LOG_LEVEL_DEBUG, "snvp [1]. selection=%i", selection);
-			if (wrapped == selection) {
-				//APP_LOG(APP_LOG_LEVEL_DEBUG, "snvp [1]. wrapped");
+			if (destination_next >= destination_count) {
+				TRACE_SELECTION(destination_next, destination_count);
 				mode = MODE_SELECT_SRC;
 				select_talon();
 				break;
-			} else if (wrapped == -1) {
-				//APP_LOG(APP_LOG_LEVEL_DEBUG, "snvp [1]. not wrapped");
-				wrapped = selection;
 			}
+			selection = destination_order[destination_next++];
+			TRACE_SELECTION(selection, 0);
 			if (destination_pile_is_valid()) {
-				//APP_LOG(APP_LOG_LEVEL_DEBUG, "snvp [1]. destination_pile_is_valid");
 				break;
 			}
 		}
 	}
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "select_next_valid_pile, end");
+	TRACE_SELECTION(selection, mode);
 }
 
 static void select_valid_pile()
@@ -505,188 +1631,587 @@ static void select_valid_pile()
 /******************************************************************************/
 /* Game Controls                                                              */
 /******************************************************************************/
+static bool queue_input(ClickHandler handler);
+static void animation_before_move(int dest);
+static void animation_after_move(uint32_t duration);
+static void auto_move_continue();
+static void finish_animation();
+
 static void up_click_handler(ClickRecognizerRef recognizer, void *context)
 {
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "up_click_handler, start");
 	// Move to next pile.
-	if (win) {
+	if (queue_input(up_click_handler) || win) {
 		return;
 	}
+	PROFILE_INPUT();
+	PROFILE_START(selection_start);
 	select_next_valid_pile();
+	PROFILE_STOP(selection_start, PROFILE_SELECTION);
 	layer_mark_dirty(game_window_layer);
-	//APP_LOG(APP_LOG_LEVEL_DEBUG, "up_click_handler, end");
 }
 
 
 static void select_click_handler(ClickRecognizerRef recognizer, void *context)
 {
+	bool moved = false;
+
 	// Begin or complete a move.
-	if (win) {
+	if (queue_input(select_click_handler) || win) {
 		return;
 	}
+	PROFILE_INPUT();
 	if (mode == MODE_SELECT_SRC) {
+		PROFILE_START(selection_start);
 		if (source_pile_is_valid()) {
 			mode = MODE_SELECT_DEST;
 			source = selection;
-			selection = PILE_FOUNDATIONS;
+			select_first_destination();
+		}
+		PROFILE_STOP(selection_start, PROFILE_SELECTION);
+	} else {
+		PROFILE_START(rules_start);
+		animation_before_move(selection);
+		if ((selection == PILE_FOUNDATIONS) ? move_to_foundation() : move_to_tableau()) {
+			replay_record(REPLAY_MOVE(source, selection));
+			moved = true;
+		}
+		PROFILE_STOP(rules_start, PROFILE_RULES);
+		PROFILE_START(selection_start);
+		mode = MODE_SELECT_SRC;
+		if (selection == PILE_FOUNDATIONS) {
+			select_talon();
+		} else {
 			select_valid_pile();
 		}
+		PROFILE_STOP(selection_start, PROFILE_SELECTION);
+		if (moved) {
+			if (win) {
+				history_finish_game();
+			}
+			animation_after_move(MOVE_ANIMATION_MS);
+		}
+	}
+	layer_mark_dirty(game_window_layer);
+}
+
+static void down_click_handler(ClickRecognizerRef recognizer, void *context)
+{
+	// Deal card to talon or abort a move in progress.
+	if (queue_input(down_click_handler) || win) {
+		return;
+	}
+	PROFILE_INPUT();
+	PROFILE_START(rules_start);
+	if (mode == MODE_SELECT_SRC && deal_card_from_stock()) {
+		replay_record(REPLAY_DEAL);
+	}
+	PROFILE_STOP(rules_start, PROFILE_RULES);
+	PROFILE_START(selection_start);
+	select_talon();
+	PROFILE_STOP(selection_start, PROFILE_SELECTION);
+	layer_mark_dirty(game_window_layer);
+}
+
+static void long_down_click_handler(ClickRecognizerRef recognizer, void *context)
+{
+	// Automatically move cards from tableau to foundation piles, one animated card at a time.
+	if (queue_input(long_down_click_handler) || win) {
+		return;
+	}
+	PROFILE_INPUT();
+	// times the press, up to the first card taking off; later moves run as each card lands
+	PROFILE_START(rules_start);
+	mode = MODE_SELECT_SRC;
+	auto_move_start();
+	if (auto_move_next_pile() >= 0) {
+		replay_record(REPLAY_AUTO_MOVE);
+	}
+	auto_moving = true;
+	auto_move_start();
+	auto_move_continue();
+	PROFILE_STOP(rules_start, PROFILE_RULES);
+}
+
+static void show_menu();
+
+static void back_click_handler(ClickRecognizerRef recognizer, void *context)
+{
+	// Land any card in flight before leaving.
+	finish_animation();
+
+	// When started straight into the game, the menu is only built on the way out.
+	if (menu_window == NULL) {
+		show_menu();
+		window_stack_remove(game_window, false);
+	} else {
+		window_stack_pop(false);
+	}
+}
+
+static void click_config_provider(void *context)
+{
+	window_single_click_subscribe(BUTTON_ID_BACK, back_click_handler);
+	window_single_click_subscribe(BUTTON_ID_UP, up_click_handler);
+	window_single_click_subscribe(BUTTON_ID_SELECT, select_click_handler);
+	window_single_click_subscribe(BUTTON_ID_DOWN, down_click_handler);
+	window_long_click_subscribe(BUTTON_ID_DOWN, 500, long_down_click_handler, NULL);
+}
+
+/******************************************************************************/
+/* Game Display                                                               */
+/******************************************************************************/
+/* -3: draw nothing, -2: draw card back, -1: draw card frame, 0+: draw card/rank/suit; the card in flight is skipped */
+static void draw_card(GContext *ctx, int x, int y, int card)
+{
+	if (card == -3 || card == flying_card) {
+		return;
+	}
+	int rank = card >> 2;
+	int suit = card % 4;
+	draw_bitmap(ctx, card_image, (GRect) { .origin = { x, y }, .size = CARD_SIZE });
+	switch (card) {
+	case -2:
+		draw_bitmap(ctx, back_image, (GRect) { .origin = { 1 + x, 1 + y }, .size = BACK_SIZE });
+		break;
+	case -1:
+		break;
+	default:
+		draw_bitmap(ctx, rank_image[rank], (GRect) { .origin = { 3 + x, 3 + y }, .size = SYMBOL_SIZE });
+		draw_bitmap(ctx, suit_image[suit], (GRect) { .origin = { 3 + x, 17 + y }, .size = SYMBOL_SIZE });
+		break;
+	}
+}
+
+/* y coordinate of face up card j in tableau pile i, before scrolling */
+static int tableau_card_y(int i, int j)
+{
+	if (view_setting == VIEW_EXPANDED) {
+		return layout_expanded_y[j - hidden_count[i]];
+	}
+	return (j > hidden_count[i]) ? LAYOUT_TABLEAU_SECOND_Y : LAYOUT_TABLEAU_Y;
+}
+
+/* Expanded view: scroll just far enough that the selector below the selected pile is visible */
+static int get_scroll_offset(int bottom)
+{
+	int y;
+
+	if (view_setting != VIEW_EXPANDED || selection > PILE_TABLEAU_RIGHT || win) {
+		return 0;
+	}
+	y = (tableau_count[selection] > 0) ? tableau_card_y(selection, tableau_count[selection] - 1) : LAYOUT_TABLEAU_Y;
+	y += SELECTOR_GAP + SELECTOR_SIZE.h;
+	return (y > bottom) ? y - bottom : 0;
+}
+
+static void draw_tableau_pile(GContext *ctx, int i, int scroll, int top, int bottom)
+{
+	int x = layout_tableau_x[i];
+	int j;
+	int y;
+
+	if (tableau_count[i] == 0) {
+		return;
+	}
+	if (view_setting != VIEW_EXPANDED) {
+		draw_card(ctx, x, LAYOUT_TABLEAU_Y, tableau[i][hidden_count[i]]);
+		if (multiple_cards_are_showing(i)) {
+			// while the top card is in flight, show the one it lands on
+			j = tableau_count[i] - 1;
+			if (tableau[i][j] == flying_card && j - 1 > hidden_count[i]) {
+				--j;
+			}
+			draw_card(ctx, x, LAYOUT_TABLEAU_SECOND_Y, tableau[i][j]);
+		}
+		return;
+	}
+
+	// skip cards whose visible strip lies above the viewport; the last card is never covered
+	j = hidden_count[i];
+	y = LAYOUT_TABLEAU_Y - scroll;
+	if (y + EXPANDED_CARD_SPACING <= top) {
+		j += (top - y) / EXPANDED_CARD_SPACING;
+		if (j > tableau_count[i] - 1) {
+			j = tableau_count[i] - 1;
+		}
+	}
+	for (; j < tableau_count[i]; ++j) {
+		y = tableau_card_y(i, j) - scroll;
+		if (y >= bottom) {
+			break;
+		}
+		if (y + CARD_HEIGHT > top) {
+			draw_card(ctx, x, y, tableau[i][j]);
+		}
+	}
+}
+
+static void draw_board(GContext *ctx)
+{
+	int i;
+	int x;
+	int y;
+	int top = LAYOUT_HEADER_HEIGHT;
+	int bottom = layer_get_bounds(game_window_layer).size.h;
+	int scroll = get_scroll_offset(bottom);
+	TRACE_RENDER(selection, scroll);
+
+	// erase layer
+	graphics_context_set_fill_color(ctx, GColorWhite);
+	graphics_fill_rect(ctx, (GRect) { .origin = { 0, top }, .size = { LAYOUT_WIDTH, bottom - top }}, 0, GCornerNone);
+
+	// draw score
+	if (score_setting == 0) {
+		if (score < 0) {
+			snprintf(score_msg, 32, "-$%i", -score);
+		} else {
+			snprintf(score_msg, 32, "$%i", score);
+		}
+		text_layer_set_text(score_layer, score_msg);
+	}
+
+	if (LAYOUT_TOP_ROW_Y + CARD_HEIGHT - scroll > top) {
+		// draw stock
+		draw_card(ctx, LAYOUT_STOCK_X, LAYOUT_TOP_ROW_Y - scroll, (stock_count > 0) ? ((talon + talon_showing < stock_count - 1) ? -2 : -1) : -3);
+
+		// draw talon
+		for (i = 0; i <= talon_showing; ++i) {
+			if ((stock_count > i) && (talon + i < stock_count)) {
+				draw_card(ctx, layout_talon_x[i], LAYOUT_TOP_ROW_Y - scroll, stock[talon + i]);
+			}
+		}
+
+		// draw foundations
+		for (i = PILE_FOUNDATION_LEFT; i <= PILE_FOUNDATION_RIGHT; ++i) {
+			// while a card flies to a foundation, show the one it lands on
+			draw_card(ctx, layout_foundation_x[i], LAYOUT_TOP_ROW_Y - scroll,
+				(foundation[i] != flying_card) ? foundation[i] : (foundation[i] >= 4) ? foundation[i] - 4 : -1);
+		}
+	}
+
+	// draw selector
+	if (!win) {
+		y = LAYOUT_TOP_SELECTOR_Y;
+		x = layout_selector_x[selection];
+		switch (selection) {
+		case PILE_TALON:
+			x = layout_talon_x[talon_showing] + 1;
+			break;
+		case PILE_FOUNDATIONS:
+			break;
+		default:
+			y = (tableau_count[selection] > 0) ? tableau_card_y(selection, tableau_count[selection] - 1) + SELECTOR_GAP : LAYOUT_EMPTY_SELECTOR_Y;
+		}
+		draw_bitmap(ctx, selector_image, (GRect) { .origin = { x, y - scroll }, .size = SELECTOR_SIZE });
+	}
+
+	// draw edges
+	for (i = PILE_TABLEAU_LEFT; i <= PILE_TABLEAU_RIGHT; ++i) {
+		for (int j = 0; j < hidden_count[i] && layout_edge_y[j] - scroll >= top; ++j) {
+			draw_bitmap(ctx, edge_image, (GRect) { .origin = { layout_tableau_x[i], layout_edge_y[j] - scroll }, .size = EDGE_SIZE });
+		}
+	}
+
+	// draw tableau
+	for (i = PILE_TABLEAU_LEFT; i <= PILE_TABLEAU_RIGHT; ++i) {
+		draw_tableau_pile(ctx, i, scroll, top, bottom);
+	}
+
+	// draw header last so that scrolled cards slide underneath it
+	graphics_context_set_fill_color(ctx, GColorBlack);
+	graphics_fill_rect(ctx, (GRect) { .origin = { 0, 0 }, .size = { LAYOUT_WIDTH, top }}, 0, GCornerNone);
+
+	// draw mode
+	if (mode == MODE_SELECT_DEST) {
+		draw_bitmap(ctx, mode1_image, (GRect) { .origin = { LAYOUT_MODE_X, LAYOUT_MODE_Y }, .size = MODE_SIZE });
+	}
+}
+
+static void game_window_layer_update_callback(Layer *me, GContext *ctx)
+{
+	// animation frames leave the board in the frame buffer and repair only behind the moving card
+	if (!animation_frame) {
+		PROFILE_START(draw_start);
+		draw_board(ctx);
+		PROFILE_FRAME_END(draw_start);
+	}
+}
+
+/******************************************************************************/
+/* Card Move Animation                                                        */
+/******************************************************************************/
+/*
+	A completed move changes the board at once, then the moved card (the
+	bottom card of a moved pile) flies from where it was to where it landed
+	on flying_layer, while the board draws without it. Positions are tweened
+	in 16.16 fixed point from the Animation progress, with an ease in/out
+	curve.
+	After the first frame the board is not redrawn: the frame buffer keeps
+	it, game_window_layer_update_callback returns at once, and repair_layer,
+	clipped to the card's old and new rectangles, redraws only the board
+	behind them. A frame is skipped when the one before it has not been drawn
+	yet, and after a frame that took longer than ANIMATION_FRAME_MS to draw
+	the next one waits ANIMATION_FRAME_MS from when it finished, so a slow
+	frame costs smoothness rather than time.
+	Presses made during an animation are queued and replayed when it ends.
+	Leaving the game window or the app lands the card, and finishes an
+	automatic move, at once.
+*/
+static uint32_t clock_ms()
+{
+	time_t t;
+	uint16_t ms;
+
+	time_ms(&t, &ms);
+	return (uint32_t)t * 1000 + ms;
+}
+
+/* Queue a press that arrives while a card is moving; true if it was taken */
+static bool queue_input(ClickHandler handler)
+{
+	if (move_animation == NULL && !auto_moving) {
+		return false;
+	}
+	if (input_queue_count < INPUT_QUEUE_SIZE) {
+		input_queue[input_queue_count++] = handler;
+	}
+	return true;
+}
+
+static void run_queued_input()
+{
+	ClickHandler handler;
+
+	while (move_animation == NULL && !auto_moving && input_queue_count > 0) {
+		handler = input_queue[0];
+		--input_queue_count;
+		memmove(input_queue, input_queue + 1, input_queue_count * sizeof(input_queue[0]));
+		handler(NULL, NULL);
+	}
+}
+
+/* Screen position of card j of tableau pile i, or of the talon or foundation j */
+static GPoint card_position(int pile, int j)
+{
+	if (pile == PILE_TALON) {
+		return GPoint(layout_talon_x[j], LAYOUT_TOP_ROW_Y - move_scroll);
+	}
+	if (pile == PILE_FOUNDATIONS) {
+		return GPoint(layout_foundation_x[j], LAYOUT_TOP_ROW_Y - move_scroll);
+	}
+	return GPoint(layout_tableau_x[pile], tableau_card_y(pile, j) - move_scroll);
+}
+
+/* The foundation a card has just landed on */
+static int foundation_index(int card)
+{
+	int i;
+
+	for (i = PILE_FOUNDATION_LEFT; i < PILE_FOUNDATION_RIGHT && foundation[i] != card; ++i) {
+	}
+	return i;
+}
+
+/* Note where the cards that may leave source for dest are drawn now */
+static void animation_before_move(int dest)
+{
+	move_scroll = get_scroll_offset(layer_get_bounds(game_window_layer).size.h);
+	move_dest = dest;
+	move_dest_count = (dest <= PILE_TABLEAU_RIGHT) ? tableau_count[dest] : 0;
+	move_card = get_source_card();
+	if (source == PILE_TALON) {
+		move_from_single = card_position(PILE_TALON, talon_showing);
+		move_from_pile = move_from_single;
 	} else {
-		if (selection == PILE_FOUNDATIONS) {
-			move_to_foundation();
-			mode = MODE_SELECT_SRC;
-			select_talon();
-		} else {
-			move_to_tableau();
-			mode = MODE_SELECT_SRC;
-			select_valid_pile();
-		}
+		move_from_single = card_position(source, tableau_count[source] - 1);
+		move_from_pile = card_position(source, hidden_count[source]);
 	}
-	layer_mark_dirty(game_window_layer);
 }
 
-static void down_click_handler(ClickRecognizerRef recognizer, void *context)
+static void move_animation_update(Animation *animation, const AnimationProgress progress)
 {
-	// Deal card to talon or abort a move in progress.
-	if (win) {
+	uint32_t now = clock_ms();
+	GRect old = layer_get_frame(flying_layer);
+	GRect frame = old;
+
+	if (animation_frame || now < animation_next_frame) {
+		PROFILE_ANIMATION_FRAME(true);
 		return;
 	}
-	if (mode == MODE_SELECT_SRC) {
-		deal_card_from_stock();
+	PROFILE_ANIMATION_FRAME(false);
+	frame.origin.x = flying_from.x + (int16_t)(((int32_t)(flying_to.x - flying_from.x) * (int32_t)progress) >> 16);
+	frame.origin.y = flying_from.y + (int16_t)(((int32_t)(flying_to.y - flying_from.y) * (int32_t)progress) >> 16);
+	if (frame.origin.x == old.origin.x && frame.origin.y == old.origin.y) {
+		return;
 	}
-	select_talon();
-	layer_mark_dirty(game_window_layer);
+
+	// repair the union of the old and new card rectangles
+	flying_damage.origin.x = (old.origin.x < frame.origin.x) ? old.origin.x : frame.origin.x;
+	flying_damage.origin.y = (old.origin.y < frame.origin.y) ? old.origin.y : frame.origin.y;
+	flying_damage.size.w = CARD_WIDTH + ((old.origin.x < frame.origin.x) ? frame.origin.x - old.origin.x : old.origin.x - frame.origin.x);
+	flying_damage.size.h = CARD_HEIGHT + ((old.origin.y < frame.origin.y) ? frame.origin.y - old.origin.y : old.origin.y - frame.origin.y);
+	layer_set_frame(repair_layer, flying_damage);
+	layer_set_bounds(repair_layer, (GRect) { .origin = { -flying_damage.origin.x, -flying_damage.origin.y }, .size = flying_damage.size });
+	layer_set_hidden(repair_layer, false);
+	layer_set_frame(flying_layer, frame);
+	animation_frame = true;
+	layer_mark_dirty(repair_layer);
 }
 
-static void long_down_click_handler(ClickRecognizerRef recognizer, void *context)
+static void move_animation_stopped(Animation *animation, bool finished, void *context)
 {
-	// Automatically move cards from tableau to foundation piles.
-	if (win) {
-		return;
-	}
-	automatically_move_to_foundations();
-	mode = MODE_SELECT_SRC;
-	select_valid_pile();
+	move_animation = NULL;
+	flying_card = -3;
+	animation_frame = false;
+	layer_set_hidden(flying_layer, true);
+	layer_set_hidden(repair_layer, true);
 	layer_mark_dirty(game_window_layer);
+	if (auto_moving) {
+		auto_move_continue();
+	}
+	run_queued_input();
 }
 
-static void click_config_provider(void *context)
+static const AnimationImplementation move_animation_implementation = {
+	.update = move_animation_update,
+};
+
+/* Fly the card that just moved; returns false when it lands at once */
+static bool animate_card(GPoint from, GPoint to, uint32_t duration)
 {
-	window_single_click_subscribe(BUTTON_ID_UP, up_click_handler);
-	window_single_click_subscribe(BUTTON_ID_SELECT, select_click_handler);
-	window_single_click_subscribe(BUTTON_ID_DOWN, down_click_handler);
-	window_long_click_subscribe(BUTTON_ID_DOWN, 500, long_down_click_handler, NULL);
+	if (animation_instant || flying_layer == NULL) {
+		return false;
+	}
+	flying_card = move_card;
+	flying_from = from;
+	flying_to = to;
+	animation_frame = false;
+	animation_next_frame = 0;
+	layer_set_frame(flying_layer, (GRect) { .origin = from, .size = CARD_SIZE });
+	layer_set_hidden(flying_layer, false);
+	layer_mark_dirty(game_window_layer);
+
+	move_animation = animation_create();
+	animation_set_duration(move_animation, duration);
+	animation_set_curve(move_animation, AnimationCurveEaseInOut);
+	animation_set_implementation(move_animation, &move_animation_implementation);
+	animation_set_handlers(move_animation, (AnimationHandlers) {
+		.stopped = move_animation_stopped,
+	}, NULL);
+	animation_schedule(move_animation);
+	return true;
 }
 
-/******************************************************************************/
-/* Game Display                                                               */
-/******************************************************************************/
-/* -3: draw nothing, -2: draw card back, -1: draw card frame, 0+: draw card/rank/suit */
-static void draw_card(GContext *ctx, int x, int y, int card)
+/* Start the flight for a move that animation_before_move saw coming */
+static void animation_after_move(uint32_t duration)
 {
-	if (card == -3) {
+	int moved;
+
+	if (move_dest == PILE_FOUNDATIONS) {
+		animate_card(move_from_single, card_position(PILE_FOUNDATIONS, foundation_index(move_card)), duration);
 		return;
 	}
-	int rank = card >> 2;
-	int suit = card % 4;
-	graphics_draw_bitmap_in_rect(ctx, card_image, (GRect) { .origin = { x, y }, .size = card_image->bounds.size });
-	switch (card) {
-	case -2:
-		graphics_draw_bitmap_in_rect(ctx, back_image, (GRect) { .origin = { 1 + x, 1 + y }, .size = back_image->bounds.size });
-		break;
-	case -1:
-		break;
-	default:
-		graphics_draw_bitmap_in_rect(ctx, rank_image[rank], (GRect) { .origin = { 3 + x, 3 + y }, .size = rank_image[rank]->bounds.size });
-		graphics_draw_bitmap_in_rect(ctx, suit_image[suit], (GRect) { .origin = { 3 + x, 17 + y }, .size = suit_image[suit]->bounds.size });
-		break;
-	}
+	moved = tableau_count[move_dest] - move_dest_count;
+	move_card = tableau[move_dest][move_dest_count];
+	move_scroll = get_scroll_offset(layer_get_bounds(game_window_layer).size.h);
+	animate_card((moved > 1) ? move_from_pile : move_from_single, card_position(move_dest, move_dest_count), duration);
 }
 
-static void game_window_layer_update_callback(Layer *me, GContext *ctx)
+/* Take automatic moves until one is animated or none are left */
+static void auto_move_continue()
 {
 	int i;
-	int x;
-	int y;
-
-	// erase layer
-	graphics_context_set_fill_color(ctx, GColorBlack);
-	graphics_fill_rect(ctx, (GRect) { .origin = { 0, 0 }, .size = { 144, 19 }}, 0, GCornerNone);
-	graphics_context_set_fill_color(ctx, GColorWhite);
-	graphics_fill_rect(ctx, (GRect) { .origin = { 0, 19 }, .size = { 144, 133 }}, 0, GCornerNone);
 
-	// draw score
-	if (score_setting == 0) {
-		if (score < 0) {
-			snprintf(score_msg, 32, "-$%i", -score);
-		} else {
-			snprintf(score_msg, 32, "$%i", score);
+	while ((i = auto_move_next_pile()) >= 0) {
+		source = i;
+		animation_before_move(PILE_FOUNDATIONS);
+		move_to_foundation();
+		if (animate_card(move_from_single, card_position(PILE_FOUNDATIONS, foundation_index(move_card)), AUTO_MOVE_ANIMATION_MS)) {
+			return;
 		}
-		text_layer_set_text(score_layer, score_msg);
 	}
-
-	// draw stock
-	draw_card(ctx, 2, 26, (stock_count > 0) ? ((talon + talon_showing < stock_count - 1) ? -2 : -1) : -3);
-
-	// draw talon
-	for (i = 0; i <= talon_showing; ++i) {
-		if ((stock_count > i) && (talon + i < stock_count)) {
-			draw_card(ctx, 22 + 9 * i, 26, stock[talon + i]);
-		}
+	auto_moving = false;
+	if (win) {
+		history_finish_game();
 	}
+	select_valid_pile();
+	layer_mark_dirty(game_window_layer);
+}
 
-	// draw foundations
-	for (i = PILE_FOUNDATION_LEFT, x = 62; i <= PILE_FOUNDATION_RIGHT; ++i, x += 20) {
-		draw_card(ctx, x, 26, foundation[i]);
+/* Land the card in flight and any automatic moves still to come; queued presses are dropped */
+static void finish_animation()
+{
+	input_queue_count = 0;
+	animation_instant = true;
+	if (move_animation != NULL) {
+		animation_unschedule(move_animation);
 	}
-
-	// draw selector
-	if (!win) {
-		y = 60;
-		switch (selection) {
-		case 7:
-			x = 23 + 9 * talon_showing;
-			break;
-		case 8:
-			x = 93;
-			break;
-		default:
-			y = multiple_cards_are_showing(selection) ? 147 : 113;
-			x = 20 * selection + 3;
-		}
-		graphics_draw_bitmap_in_rect(ctx, selector_image, (GRect) { .origin = { x, y }, .size = selector_image->bounds.size });
+	if (auto_moving) {
+		auto_move_continue();
 	}
+	animation_instant = false;
+}
 
-	// draw edges
-	GRect bounds = edge_image->bounds;
-	for (i = PILE_TABLEAU_LEFT; i <= PILE_TABLEAU_RIGHT; ++i) {
-		for (int j = 0; j < hidden_count[i]; ++j) {
-			graphics_draw_bitmap_in_rect(ctx, edge_image, (GRect) { .origin = { 20 * i + 2, 77 - 2 * j }, .size = bounds.size });
-		}
+static void flying_layer_update_callback(Layer *me, GContext *ctx)
+{
+	int card = flying_card;
+	uint32_t now;
+
+	// draw_card leaves out the card in flight, except here
+	flying_card = -3;
+	draw_card(ctx, 0, 0, card);
+	flying_card = card;
+	if (animation_frame) {
+		// the flying layer draws last, so this is the end of the frame
+		animation_frame = false;
+		now = clock_ms();
+		animation_next_frame = (now - animation_frame_start > ANIMATION_FRAME_MS) ? now + ANIMATION_FRAME_MS : 0;
 	}
+}
 
-	// draw tableau
-	for (i = PILE_TABLEAU_LEFT, x = 2; i <= PILE_TABLEAU_RIGHT; ++i, x += 20) {
-		if (tableau_count[i] > 0) {
-			draw_card(ctx, x, 79, tableau[i][hidden_count[i]]);
-			if (multiple_cards_are_showing(i)) {
-				draw_card(ctx, x, 113, tableau[i][tableau_count[i] - 1]);
-			}
-		}
-	}
+static void repair_layer_update_callback(Layer *me, GContext *ctx)
+{
+	PROFILE_START(draw_start);
 
-	// draw mode
-	if (mode == MODE_SELECT_DEST) {
-		graphics_draw_bitmap_in_rect(ctx, mode1_image, (GRect) { .origin = { 2, 3 }, .size = mode1_image->bounds.size });
-	}
+	animation_frame_start = clock_ms();
+	repairing = true;
+	draw_board(ctx);
+	repairing = false;
+	PROFILE_REPAIR_END(draw_start);
 }
 
+/*
+	The game window, its bitmaps and the score layer are created the first time
+	a game is shown and then reused for every Play and Re-deal, so later pushes
+	neither allocate nor decode anything. They are destroyed in deinit.
+*/
+static void load_game();
+
 static void game_window_load(Window *window)
 {
-	game_window_layer = window_get_root_layer(window);
+	// bitmaps are decoded by now; the board is read just before the first frame
+	load_game();
+	MEMORY_CHECKPOINT("game load");
+}
+
+static void game_window_unload(Window *window)
+{
+	MEMORY_CHECKPOINT("game unload");
+}
+
+static void create_game_window()
+{
+	game_window = window_create();
+	window_set_click_config_provider(game_window, click_config_provider);
+	window_set_window_handlers(game_window, (WindowHandlers) {
+		.load = game_window_load,
+		.unload = game_window_unload,
+	});
+	game_window_layer = window_get_root_layer(game_window);
 	layer_set_update_proc(game_window_layer, game_window_layer_update_callback);
 
 	// load images
+	MEMORY_TRACK_BEGIN(bitmaps_before);
 	card_image = gbitmap_create_with_resource(RESOURCE_ID_IMAGE_CARD);
 	back_image = gbitmap_create_with_resource(RESOURCE_ID_IMAGE_BACK);
 	edge_image = gbitmap_create_with_resource(RESOURCE_ID_IMAGE_EDGE);
@@ -709,39 +2234,58 @@ static void game_window_load(Window *window)
 	suit_image[1] = gbitmap_create_with_resource(RESOURCE_ID_IMAGE_CLUB);
 	suit_image[2] = gbitmap_create_with_resource(RESOURCE_ID_IMAGE_HEART);
 	suit_image[3] = gbitmap_create_with_resource(RESOURCE_ID_IMAGE_DIAMOND);
-
-	score_layer = text_layer_create((GRect) { .origin = { 80, 0 }, .size = { 62, 17 } });
+	MEMORY_TRACK_END(bitmaps_before, MEMORY_BITMAPS);
+
+	// card move animation; below the score so that a card slides under the header
+	repair_layer = layer_create(layer_get_bounds(game_window_layer));
+	layer_set_update_proc(repair_layer, repair_layer_update_callback);
+	layer_set_hidden(repair_layer, true);
+	layer_add_child(game_window_layer, repair_layer);
+	flying_layer = layer_create((GRect) { .origin = { 0, 0 }, .size = CARD_SIZE });
+	layer_set_update_proc(flying_layer, flying_layer_update_callback);
+	layer_set_hidden(flying_layer, true);
+	layer_add_child(game_window_layer, flying_layer);
+
+	MEMORY_TRACK_BEGIN(text_before);
+	score_layer = text_layer_create((GRect) LAYOUT_SCORE_FRAME);
 	text_layer_set_text_alignment(score_layer, GTextAlignmentRight);
 	text_layer_set_font(score_layer, fonts_get_system_font(FONT_KEY_GOTHIC_14));
 	text_layer_set_background_color(score_layer, GColorBlack);
 	text_layer_set_text_color(score_layer, GColorWhite);
 	layer_add_child(game_window_layer, text_layer_get_layer(score_layer));
+	MEMORY_TRACK_END(text_before, MEMORY_TEXT);
 }
 
-static void game_window_unload(Window *window)
+static void destroy_game_window()
 {
+	MEMORY_TRACK_BEGIN(bitmaps_before);
 	gbitmap_destroy(card_image);
 	gbitmap_destroy(back_image);
 	gbitmap_destroy(edge_image);
 	gbitmap_destroy(selector_image);
 	gbitmap_destroy(mode1_image);
-	for (int i = 0; i < 13; ++i) {
+	for (int i = 0; i < RANKS; ++i) {
 		gbitmap_destroy(rank_image[i]);
 	}
-	for (int i = 0; i < 4; ++i) {
+	for (int i = 0; i < SUITS; ++i) {
 		gbitmap_destroy(suit_image[i]);
 	}
+	MEMORY_TRACK_END(bitmaps_before, MEMORY_BITMAPS);
+	MEMORY_TRACK_BEGIN(text_before);
 	text_layer_destroy(score_layer);
+	MEMORY_TRACK_END(text_before, MEMORY_TEXT);
+	layer_destroy(flying_layer);
+	layer_destroy(repair_layer);
+	window_destroy(game_window);
 }
 
 static void play_game()
 {
-	game_window = window_create();
-	window_set_click_config_provider(game_window, click_config_provider);
-	window_set_window_handlers(game_window, (WindowHandlers) {
-		.load = game_window_load,
-		.unload = game_window_unload,
-	});
+	// latency of opening the game window counts from here
+	PROFILE_INPUT();
+	if (game_window == NULL) {
+		create_game_window();
+	}
 	window_stack_push(game_window, false);
 }
 
@@ -753,12 +2297,29 @@ static int rnd(int max)
 {
 	int v;
 	do {
-		seed = (seed * 214013 + 2531011) & ((1U << 31) - 1);
+		seed = (int)(((unsigned)seed * 214013 + 2531011) & ((1U << 31) - 1));
 		v = seed >> 26;
 	} while (v > max);
 	return v;
 }
 
+static void toggle_draw_setting()
+{
+	if (draw_setting == 0) {
+		draw_setting = 1;
+		talon_showing = stock_count - talon - 1;
+		if (talon_showing > 2) {
+			talon_showing = 2;
+		} else if (talon_showing < 0) {
+			// empty stock
+			talon_showing = 0;
+		}
+	} else {
+		draw_setting = 0;
+		talon_showing = 0;
+	}
+}
+
 static void shuffle_and_deal()
 {
  	int i;
@@ -766,11 +2327,16 @@ static void shuffle_and_deal()
  	int k;
 
  	/* shuffle */
+#ifdef DEAL_SEED
+	seed = DEAL_SEED;
+#else
 	seed = time(NULL);
-	for (i = 0; i < 52; ++i) {
+#endif
+	replay_seed = seed;
+	for (i = 0; i < CARDS; ++i) {
 		deck[i] = i;
 	}
-	for (i = 51; i >= 1; --i) {
+	for (i = CARDS - 1; i >= 1; --i) {
 		j = rnd(i);
 		k = deck[j];
 		deck[j] = deck[i];
@@ -778,26 +2344,31 @@ static void shuffle_and_deal()
 	}
 
 	/* deal */
-	for (i = 0; i < 24; ++i) {
+	for (i = 0; i < STOCK_SIZE; ++i) {
 		stock[i] = deck[i];
-		//APP_LOG(APP_LOG_LEVEL_DEBUG, "stock[%i]=%i, rank=%i, suit=%i, card=%c%c", i, stock[i], stock[i]>>2, stock[i]%4, "A23456789TJQK"[stock[i]>>2], "SCHD"[stock[i]%4]);
+		TRACE_DEAL(i, stock[i]);
 	}
-	stock_count = 24;
+	stock_count = STOCK_SIZE;
 	talon = 0;
 	talon_showing = draw_setting ? 2 : 0;
-	for (i = 0; i < 4; ++i) {
+	for (i = PILE_FOUNDATION_LEFT; i <= PILE_FOUNDATION_RIGHT; ++i) {
 		foundation[i] = -1;
 	}
-	for (i = 0, k = 24; i < 7; ++i) {
-		for (j = 0; j <= i; ++j, ++k) {
+	for (i = PILE_TABLEAU_LEFT, k = STOCK_SIZE; i <= PILE_TABLEAU_RIGHT; ++i) {
+		for (j = 0; j < DEAL_HIDDEN(i) + DEAL_SHOWING(i); ++j, ++k) {
 			tableau[i][j] = deck[k];
 		}
-		hidden_count[i] = i;
-		tableau_count[i] = i + 1;
+		hidden_count[i] = DEAL_HIDDEN(i);
+		tableau_count[i] = DEAL_HIDDEN(i) + DEAL_SHOWING(i);
 	}
 	win = false;
-	score -= 52;
+	score -= CARDS;
 	flips = 0;
+	replay_start();
+	game_moves = 0;
+	game_seconds = 0;
+	game_action_time = 0;
+	game_recorded = false;
 	select_talon();
 }
 
@@ -805,7 +2376,8 @@ static void shuffle_and_deal()
 /* Serialization                                                              */
 /******************************************************************************/
 /*
-	Serialization format:
+	Serialization format (offsets for Klondike; the STATE_ macros give them
+	for any variant):
 	Bytes	Description		Offset
 	-----	-----------		------
 	1	stock_count		0
@@ -814,40 +2386,138 @@ static void shuffle_and_deal()
 	7	tableau_count		6
 	7	hidden_count		13
 	<=52	stock, tableau[0-7]	20
+	1	win			72
+	1	draw_setting		73
+	1	fliplimit_setting	74
+	1	score_setting		75
+	1	flips			76
+	1	talon_showing		77
+	4	score			78
 	--
-	72
+	82
+	An empty foundation is saved as STATE_NO_CARD.
+*/
+#define STATE_NO_CARD 255
+#define STATE_FOUNDATIONS 2
+#define STATE_TABLEAU_COUNT (STATE_FOUNDATIONS + FOUNDATION_PILES)
+#define STATE_HIDDEN_COUNT (STATE_TABLEAU_COUNT + TABLEAU_PILES)
+#define STATE_CARDS (STATE_HIDDEN_COUNT + TABLEAU_PILES)
+#define STATE_SETTINGS (STATE_CARDS + CARDS)
+#define STATE_SIZE (STATE_SETTINGS + 10)
+_Static_assert(CARDS <= STATE_NO_CARD, "cards must fit a byte below STATE_NO_CARD");
+
+/* everything persisted must fit the per-app storage limit */
+#if STATE_SIZE + 2 + 17 + REPLAY_MAX_ACTIONS + HISTORY_HEADER_SIZE + HISTORY_SHARDS * PERSIST_DATA_MAX_LENGTH > PERSIST_STORAGE_LIMIT
+#error "persistent storage over PERSIST_STORAGE_LIMIT"
+#endif
+/*
+	Options added after the state format above was fixed are kept under their
+	own key, one byte each, so that older saves still load. Missing trailing
+	bytes read back as zero, the default for every option.
+	Bytes	Description		Offset
+	-----	-----------		------
+	1	view_setting		0
+	1	start_setting		1
 */
+static void save_options()
+{
+	unsigned char options[2];
+
+	options[0] = (unsigned char)view_setting;
+	options[1] = (unsigned char)start_setting;
+	persist_write_data(PERSIST_KEY_OPTIONS, options, sizeof(options));
+}
+
+static void load_options()
+{
+	unsigned char options[2] = {0};
+
+#ifndef BENCHMARK
+	// benchmark builds keep the defaults: tools/bench sequences start at the menu, in the compact view
+	persist_read_data(PERSIST_KEY_OPTIONS, options, sizeof(options));
+#endif
+	view_setting = options[0] % 2;
+	start_setting = options[1] % 2;
+}
+
+/* The replay header is the first 17 bytes of the exported format */
+static void save_replay()
+{
+	unsigned char header[REPLAY_HEADER_SIZE];
+	int i;
+
+	if (!replay_valid) {
+		persist_delete(PERSIST_KEY_REPLAY);
+		return;
+	}
+	replay_header(header);
+	persist_write_data(PERSIST_KEY_REPLAY, header, 17);
+	for (i = 0; i * PERSIST_DATA_MAX_LENGTH < replay_count; ++i) {
+		persist_write_data(PERSIST_KEY_REPLAY + 1 + i, replay_actions + i * PERSIST_DATA_MAX_LENGTH,
+			(replay_count - i * PERSIST_DATA_MAX_LENGTH < PERSIST_DATA_MAX_LENGTH) ?
+			replay_count - i * PERSIST_DATA_MAX_LENGTH : PERSIST_DATA_MAX_LENGTH);
+	}
+}
+
+static void load_replay()
+{
+	unsigned char header[17];
+	int i;
+
+	replay_valid = false;
+	if (persist_read_data(PERSIST_KEY_REPLAY, header, 17) != 17 || memcmp(header, "SRP1", 4) != 0) {
+		return;
+	}
+	memcpy((char*)&replay_seed, header + 4, 4);
+	replay_draw_setting = header[8];
+	replay_fliplimit_setting = header[9];
+	memcpy((char*)&replay_start_score, header + 10, 4);
+	replay_count = header[14] | header[15] << 8;
+	replay_truncated = header[16];
+	if (replay_count > REPLAY_MAX_ACTIONS) {
+		return;
+	}
+	for (i = 0; i * PERSIST_DATA_MAX_LENGTH < replay_count; ++i) {
+		persist_read_data(PERSIST_KEY_REPLAY + 1 + i, replay_actions + i * PERSIST_DATA_MAX_LENGTH,
+			PERSIST_DATA_MAX_LENGTH);
+	}
+	replay_valid = true;
+}
+
 static void save_state()
 {
 	int i;
 	int j;
 	int b;
-	unsigned char state[82];
+	unsigned char state[STATE_SIZE];
 
 	state[0] = (unsigned char)stock_count;
 	for (i = 0; i < stock_count; ++i) {
-		state[20 + i] = (unsigned char)stock[i];
+		state[STATE_CARDS + i] = (unsigned char)stock[i];
 	}
 	state[1] = (unsigned char)talon;
 	for (i = PILE_FOUNDATION_LEFT; i <= PILE_FOUNDATION_RIGHT; ++i) {
-		state[2 + i] = (unsigned char)foundation[i];
+		state[STATE_FOUNDATIONS + i] = (foundation[i] < 0) ? STATE_NO_CARD : (unsigned char)foundation[i];
 	}
-	b = 20 + stock_count;
+	b = STATE_CARDS + stock_count;
 	for (i = PILE_TABLEAU_LEFT; i <= PILE_TABLEAU_RIGHT; ++i) {
-		state[6 + i] = (unsigned char)tableau_count[i];
-		state[13 + i] = (unsigned char)hidden_count[i];
+		state[STATE_TABLEAU_COUNT + i] = (unsigned char)tableau_count[i];
+		state[STATE_HIDDEN_COUNT + i] = (unsigned char)hidden_count[i];
 		for (j = 0; j < tableau_count[i]; ++j, ++b) {
 			state[b] = tableau[i][j];
 		}
 	}
-	state[72] = (unsigned char)win;
-	state[73] = (unsigned char)draw_setting;
-	state[74] = (unsigned char)fliplimit_setting;
-	state[75] = (unsigned char)score_setting;
-	state[76] = (unsigned char)flips;
-	state[77] = (unsigned char)talon_showing;
-	memcpy(state + 78, (char*)&score, 4);
-	persist_write_data(0, state, 82);
+	state[STATE_SETTINGS] = (unsigned char)win;
+	state[STATE_SETTINGS + 1] = (unsigned char)draw_setting;
+	state[STATE_SETTINGS + 2] = (unsigned char)fliplimit_setting;
+	state[STATE_SETTINGS + 3] = (unsigned char)score_setting;
+	state[STATE_SETTINGS + 4] = (unsigned char)flips;
+	state[STATE_SETTINGS + 5] = (unsigned char)talon_showing;
+	memcpy(state + STATE_SETTINGS + 6, (char*)&score, 4);
+	TRACE_PERSIST(stock_count, score);
+	persist_write_data(PERSIST_KEY_STATE, state, STATE_SIZE);
+	save_options();
+	save_replay();
 }
 
 static bool load_state()
@@ -855,74 +2525,237 @@ static bool load_state()
 	int i;
 	int j;
 	int b;
-	unsigned char state[82];
+	unsigned char state[STATE_SIZE];
 
-	if (persist_read_data(0, state, 82) != 82) {
+	if (persist_read_data(PERSIST_KEY_STATE, state, STATE_SIZE) != STATE_SIZE) {
+		TRACE_PERSIST(persist_get_size(PERSIST_KEY_STATE), STATE_SIZE);
 		return false;
 	} 
 	//score = persist_read_int(0);
-	win = state[72];
-	draw_setting = state[73];
-	fliplimit_setting = state[74];
-	score_setting = state[75];
-	flips = state[76];
-	talon_showing = state[77];
-	memcpy((char*)&score, state + 78, 4);
+	win = state[STATE_SETTINGS];
+	draw_setting = state[STATE_SETTINGS + 1];
+	fliplimit_setting = state[STATE_SETTINGS + 2];
+	score_setting = state[STATE_SETTINGS + 3];
+	flips = state[STATE_SETTINGS + 4];
+	talon_showing = state[STATE_SETTINGS + 5];
+	memcpy((char*)&score, state + STATE_SETTINGS + 6, 4);
 
 	stock_count = state[0];
 	for (i = 0; i < stock_count; ++i) {
-		stock[i] = state[20 + i];
+		stock[i] = state[STATE_CARDS + i];
 	}
 	talon = state[1];
 	for (i = PILE_FOUNDATION_LEFT; i <= PILE_FOUNDATION_RIGHT; ++i) {
-		foundation[i] = state[2 + i];
-		if (foundation[i] == 255) {
+		foundation[i] = state[STATE_FOUNDATIONS + i];
+		if (foundation[i] == STATE_NO_CARD) {
 			foundation[i] = -1;
 		}
 	}
-	b = 20 + stock_count;
+	b = STATE_CARDS + stock_count;
 	for (i = PILE_TABLEAU_LEFT; i <= PILE_TABLEAU_RIGHT; ++i) {
-		tableau_count[i] = state[6 + i];
-		hidden_count[i] = state[13 + i];
+		tableau_count[i] = state[STATE_TABLEAU_COUNT + i];
+		hidden_count[i] = state[STATE_HIDDEN_COUNT + i];
 		for (j = 0; j < tableau_count[i]; ++j, ++b) {
 			tableau[i][j] = state[b];
 		}
 	}
+	TRACE_PERSIST(stock_count, score);
+	load_replay();
 	select_talon();
 	return true;
 }
 
+/* Restore the saved game, or deal a new one; runs once, on first need */
+static void load_game()
+{
+	if (state_loaded) {
+		return;
+	}
+	state_loaded = true;
+	if (!load_state()) {
+		score = 0;
+		shuffle_and_deal();
+	}
+	history_load();
+}
+
 /******************************************************************************/
 /* Menus and App Initialization                                               */
 /******************************************************************************/
+/*
+	Help and about texts are raw resources, shown one screen at a time. A
+	page is laid out only when it is first shown: at most TEXT_CHUNK bytes
+	from the page start are loaded, and the longest prefix that fits the
+	screen (cut at a space or line break) is found by binary search with
+	graphics_text_layout_get_max_used_size(). Page start offsets are cached,
+	so paging back costs only a resource read. In-memory text (the profile
+	report) goes through the same path.
+	The text window is pooled like the game window; only its source changes
+	between uses.
+*/
+static bool text_fits(GContext *ctx, GFont font, GRect box, int length)
+{
+	char saved = text_chunk[length];
+	GSize size;
+
+	text_chunk[length] = '\0';
+	// measure in a tall box, as the used size is clipped to the box height
+	size = graphics_text_layout_get_max_used_size(ctx, text_chunk, font, GRect(box.origin.x, box.origin.y, box.size.w, 2000),
+		GTextOverflowModeWordWrap, GTextAlignmentLeft, NULL);
+	text_chunk[length] = saved;
+	return size.h <= box.size.h;
+}
+
+static void text_load_page(GContext *ctx, GFont font, GRect box)
+{
+	size_t start = text_page_start[text_page];
+	int length = (text_length - start < TEXT_CHUNK) ? (int)(text_length - start) : TEXT_CHUNK;
+	int lo;
+	int hi;
+	int mid;
+	size_t next;
+
+	if (text_resource != 0) {
+		resource_load_byte_range(resource_get_handle(text_resource), start, (uint8_t *)text_chunk, length);
+	} else {
+		memcpy(text_chunk, text + start, length);
+	}
+	text_chunk[length] = '\0';
+	text_chunk_page = text_page;
+
+	if (text_page + 1 < text_pages_known) {
+		// already laid out
+		text_chunk[text_page_start[text_page + 1] - start] = '\0';
+		return;
+	}
+	if (text_page == text_last_page) {
+		return;
+	}
+
+	if (!text_fits(ctx, font, box, length)) {
+		// invariant: lo fits, hi does not
+		lo = 0;
+		hi = length;
+		while (hi - lo > 1) {
+			mid = (lo + hi) / 2;
+			if (text_fits(ctx, font, box, mid)) {
+				lo = mid;
+			} else {
+				hi = mid;
+			}
+		}
+		for (mid = lo; mid > 0 && text_chunk[mid] != ' ' && text_chunk[mid] != '\n'; --mid) {
+		}
+		length = (mid > 0) ? mid : lo;
+	}
+
+	next = start + length;
+	while (next < text_length && (text_chunk[next - start] == ' ' || text_chunk[next - start] == '\n')) {
+		++next;
+	}
+	text_chunk[length] = '\0';
+	if (next >= text_length) {
+		text_last_page = text_page;
+		return;
+	}
+	// a last page cut short by TEXT_MAX_PAGES keeps its end, so paging back to it shows the same text
+	if (text_page + 1 >= TEXT_MAX_PAGES) {
+		text_last_page = text_page;
+	}
+	text_page_start[text_page + 1] = (uint16_t)next;
+	text_pages_known = text_page + 2;
+}
+
+static void text_page_layer_update_callback(Layer *me, GContext *ctx)
+{
+	GRect bounds = layer_get_bounds(me);
+	GRect box = GRect(2, 0, bounds.size.w - 4, bounds.size.h - 18);
+	GFont font = fonts_get_system_font(FONT_KEY_GOTHIC_18);
+	char footer[24];
+
+	if (text_chunk_page != text_page) {
+		text_load_page(ctx, font, box);
+	}
+	graphics_context_set_text_color(ctx, GColorBlack);
+	graphics_draw_text(ctx, text_chunk, font, box, GTextOverflowModeWordWrap, GTextAlignmentLeft, NULL);
+
+	snprintf(footer, sizeof(footer), "%s%i%s", (text_page > 0) ? "< " : "", text_page + 1, (text_page != text_last_page) ? " >" : "");
+	graphics_draw_text(ctx, footer, fonts_get_system_font(FONT_KEY_GOTHIC_14), GRect(0, bounds.size.h - 17, bounds.size.w, 17),
+		GTextOverflowModeTrailingEllipsis, GTextAlignmentCenter, NULL);
+}
+
+static void text_up_click_handler(ClickRecognizerRef recognizer, void *context)
+{
+	if (text_page > 0) {
+		--text_page;
+		layer_mark_dirty(text_page_layer);
+	}
+}
+
+static void text_down_click_handler(ClickRecognizerRef recognizer, void *context)
+{
+	// the next page start is known once the current page has been drawn
+	if (text_page != text_last_page && text_page + 1 < text_pages_known) {
+		++text_page;
+		layer_mark_dirty(text_page_layer);
+	}
+}
+
+static void text_click_config_provider(void *context)
+{
+	window_single_click_subscribe(BUTTON_ID_UP, text_up_click_handler);
+	window_single_click_subscribe(BUTTON_ID_SELECT, text_down_click_handler);
+	window_single_click_subscribe(BUTTON_ID_DOWN, text_down_click_handler);
+}
+
 static void text_window_load(Window *window)
 {
-	text_window_layer = window_get_root_layer(window);
-	text_scroll_layer = scroll_layer_create(layer_get_bounds(text_window_layer));
-	scroll_layer_set_click_config_onto_window(text_scroll_layer, window);
-	text_layer = text_layer_create(GRect(0, 0, 144, 2000));
-	text_layer_set_text(text_layer, text);
-	GSize max_size = text_layer_get_content_size(text_layer);
-	text_layer_set_size(text_layer, GSize(max_size.w, max_size.h + 20));
-	scroll_layer_set_content_size(text_scroll_layer, GSize(144, max_size.h + 20));
-	scroll_layer_add_child(text_scroll_layer, text_layer_get_layer(text_layer));
-	layer_add_child(text_window_layer, scroll_layer_get_layer(text_scroll_layer));
+	MEMORY_CHECKPOINT("text load");
 }
 
 static void text_window_unload(Window *window)
 {
-	text_layer_destroy(text_layer);
-	scroll_layer_destroy(text_scroll_layer);
-	window_destroy(text_window);
+	MEMORY_CHECKPOINT("text unload");
 }
 
-static void text_area()
+static void create_text_window()
 {
 	text_window = window_create();
+	window_set_click_config_provider(text_window, text_click_config_provider);
 	window_set_window_handlers(text_window, (WindowHandlers) {
 		.load = text_window_load,
 		.unload = text_window_unload,
 	});
+	text_window_layer = window_get_root_layer(text_window);
+	MEMORY_TRACK_BEGIN(text_before);
+	text_page_layer = layer_create(layer_get_bounds(text_window_layer));
+	layer_set_update_proc(text_page_layer, text_page_layer_update_callback);
+	layer_add_child(text_window_layer, text_page_layer);
+	MEMORY_TRACK_END(text_before, MEMORY_TEXT);
+}
+
+static void destroy_text_window()
+{
+	MEMORY_TRACK_BEGIN(text_before);
+	layer_destroy(text_page_layer);
+	MEMORY_TRACK_END(text_before, MEMORY_TEXT);
+	window_destroy(text_window);
+}
+
+/* Show text from a raw resource, or from memory when resource_id is 0 */
+static void text_area(uint32_t resource_id, const char *str)
+{
+	if (text_window == NULL) {
+		create_text_window();
+	}
+	text_resource = resource_id;
+	text = str;
+	text_length = (resource_id != 0) ? resource_size(resource_get_handle(resource_id)) : strlen(str);
+	text_page_start[0] = 0;
+	text_pages_known = 1;
+	text_last_page = -1;
+	text_page = 0;
+	text_chunk_page = -1;
 	window_stack_push(text_window, false);
 }
 
@@ -934,7 +2767,8 @@ static void game_menu_select_callback(int index, void *ctx)
 		play_game();
 		break;
 	case 1:
-		// Re-deal
+		// Re-deal; the game given up goes into the history
+		history_finish_game();
 		shuffle_and_deal();
 		play_game();
 		break;
@@ -947,28 +2781,31 @@ static void settings_menu_select_callback(int index, void *ctx)
 	switch (index) {
 	case 0:
 		// Draw
-		if (draw_setting == 0) {
-			draw_setting = 1;
-			talon_showing = stock_count - talon - 1;
-			if (talon_showing > 2) {
-				talon_showing = 2;
-			}
-		} else {
-			draw_setting = 0;
-			talon_showing = 0;
-		}
+		toggle_draw_setting();
 		settings_menu_items[0].subtitle = draw_options[draw_setting];
+		replay_record(REPLAY_SETTINGS(draw_setting, fliplimit_setting));
 		break;
 	case 1:
 		// Flips
 		fliplimit_setting = (fliplimit_setting + 1) % 4;
 		settings_menu_items[1].subtitle = fliplimit_options[fliplimit_setting];
+		replay_record(REPLAY_SETTINGS(draw_setting, fliplimit_setting));
 		break;
 	case 2:
 		// Score
 		score_setting = (score_setting + 1) % 2;
 		settings_menu_items[2].subtitle = score_options[score_setting];
 		break;
+	case 3:
+		// View
+		view_setting = (view_setting + 1) % 2;
+		settings_menu_items[3].subtitle = view_options[view_setting];
+		break;
+	case 4:
+		// Start
+		start_setting = (start_setting + 1) % 2;
+		settings_menu_items[4].subtitle = start_options[start_setting];
+		break;
 	}
 	layer_mark_dirty(simple_menu_layer_get_layer(simple_menu_layer));
 }
@@ -979,17 +2816,30 @@ static void tools_menu_select_callback(int index, void *ctx)
 	case 0:
 		// Reset Score
 		score = 0;
+		replay_record(REPLAY_RESET_SCORE);
 		break;
 	case 1:
 		// Help
-		text = HELP_TEXT;
-		text_area();
+		text_area(TEXT_HELP, NULL);
 		break;
 	case 2:
 		// About
-		text = ABOUT_TEXT;
-		text_area();
+		text_area(TEXT_ABOUT, NULL);
+		break;
+	case 3:
+		// Export Replay
+		replay_export();
+		break;
+	case 4:
+		// Statistics
+		text_area(0, history_report());
+		break;
+#ifdef PROFILE
+	case 5:
+		// Profile
+		text_area(0, profile_report());
 		break;
+#endif
 	}
 	layer_mark_dirty(simple_menu_layer_get_layer(simple_menu_layer));
 }
@@ -1020,6 +2870,16 @@ static void menu_window_load(Window *window)
 		.subtitle = score_options[score_setting],
 		.callback = settings_menu_select_callback,
 	};
+	settings_menu_items[3] = (SimpleMenuItem){
+		.title = "View",
+		.subtitle = view_options[view_setting],
+		.callback = settings_menu_select_callback,
+	};
+	settings_menu_items[4] = (SimpleMenuItem){
+		.title = "Start",
+		.subtitle = start_options[start_setting],
+		.callback = settings_menu_select_callback,
+	};
 
 	tools_menu_items[0] = (SimpleMenuItem){
 		.title = "Reset Score",
@@ -1033,6 +2893,21 @@ static void menu_window_load(Window *window)
 		.title = "About",
 		.callback = tools_menu_select_callback,
 	};
+	tools_menu_items[3] = (SimpleMenuItem){
+		.title = "Export Replay",
+		.subtitle = "To the app log",
+		.callback = tools_menu_select_callback,
+	};
+	tools_menu_items[4] = (SimpleMenuItem){
+		.title = "Statistics",
+		.callback = tools_menu_select_callback,
+	};
+#ifdef PROFILE
+	tools_menu_items[5] = (SimpleMenuItem){
+		.title = "Profile",
+		.callback = tools_menu_select_callback,
+	};
+#endif
 
 	menu_sections[0] = (SimpleMenuSection){
 		.title = "Game",
@@ -1041,32 +2916,34 @@ static void menu_window_load(Window *window)
 	};
 	menu_sections[1] = (SimpleMenuSection){
 		.title = "Settings",
-		.num_items = 3,
+		.num_items = 5,
 		.items = settings_menu_items,
 	};
 	menu_sections[2] = (SimpleMenuSection){
 		.title = "Tools",
-		.num_items = 3,
+		.num_items = sizeof(tools_menu_items) / sizeof(tools_menu_items[0]),
 		.items = tools_menu_items,
 	};
 
 	Layer *window_layer = window_get_root_layer(window);
+	MEMORY_TRACK_BEGIN(menu_before);
 	simple_menu_layer = simple_menu_layer_create(layer_get_frame(window_layer), window, menu_sections, 3, NULL);
+	MEMORY_TRACK_END(menu_before, MEMORY_MENU);
 	layer_add_child(window_layer, simple_menu_layer_get_layer(simple_menu_layer));
+	MEMORY_CHECKPOINT("menu load");
 }
 
 static void menu_window_unload(Window *window)
 {
+	MEMORY_TRACK_BEGIN(menu_before);
 	simple_menu_layer_destroy(simple_menu_layer);
+	MEMORY_TRACK_END(menu_before, MEMORY_MENU);
+	MEMORY_CHECKPOINT("menu unload");
 }
 
-static void init(void)
+static void show_menu()
 {
-	if (!load_state()) {
-		score = 0;
-		shuffle_and_deal();
-	}
-
+	load_game();
 	menu_window = window_create();
 	window_set_window_handlers(menu_window, (WindowHandlers) {
 		.load = menu_window_load,
@@ -1075,10 +2952,35 @@ static void init(void)
 	window_stack_push(menu_window, false);
 }
 
+static void init(void)
+{
+	load_options();
+	if (start_setting == START_GAME) {
+		PROFILE_STARTUP();
+		play_game();
+	} else {
+		show_menu();
+	}
+}
+
 static void deinit(void)
 {
+	finish_animation();
 	save_state();
-	window_destroy(game_window);
+	if (history_timer != NULL) {
+		app_timer_cancel(history_timer);
+	}
+	history_flush();
+	TRACE_FLUSH();
+	if (game_window != NULL) {
+		destroy_game_window();
+	}
+	if (text_window != NULL) {
+		destroy_text_window();
+	}
+	if (menu_window != NULL) {
+		window_destroy(menu_window);
+	}
 }
 
 int main(void)
@@ -0,0 +1,190 @@
+#!/usr/bin/env python
+"""
+emu_bench.py -- scripted input benchmark in the Pebble emulator
+
+Usage: python tools/bench/emu_bench.py [--platform aplite] [--seeds 1,2,3]
+                                       [--baseline tools/bench/baseline.json]
+                                       [--update-baseline] [sequence.txt ...]
+
+For every deal seed the app is built with PROFILE, BENCHMARK and DEAL_SEED
+defined (through SOLITAIRE_CFLAGS, see wscript) and installed into the
+emulator. Each sequence file is then replayed with "pebble emu-button".
+Sequence files hold button names separated by white space: U (up),
+S (select), D (down), L (long down) and B (back); "#" starts a comment.
+Sequences are run from the menu, so they usually begin with "D S"
+(Re-deal) to get the seed's board. BENCHMARK builds ignore the saved
+options, so the app opens at the menu in the compact view even if Start or
+View were changed in the emulator before.
+
+The app logs one "bench frame" line per frame. The first frame after a press
+carries the press-to-drawn latency, and every frame before the next press
+is counted against it. The script prints per-sequence latency and frame
+statistics and compares the median and 90th percentile latencies against
+the baseline. It exits non-zero if either is more than --tolerance percent
+(and more than --slack ms) slower. --update-baseline stores the current
+results in the baseline, keeping entries for sequences and seeds not run.
+No baseline is checked in: record one on the emulator first.
+"""
+import argparse
+import glob
+import json
+import os
+import re
+import subprocess
+import sys
+import threading
+import time
+
+BUTTONS = {'U': 'up', 'S': 'select', 'D': 'down', 'L': 'down', 'B': 'back'}
+FRAME = re.compile(r'bench frame (-?\d+) (\d+) (\d+) (\d+)')
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(os.path.dirname(HERE))
+
+
+class LogReader(threading.Thread):
+    """Collects "bench frame" lines from "pebble logs" as they arrive."""
+
+    def __init__(self, platform):
+        threading.Thread.__init__(self)
+        self.daemon = True
+        self.frames = []
+        self.lock = threading.Lock()
+        self.process = subprocess.Popen(['pebble', 'logs', '--emulator', platform],
+                                        cwd=ROOT, stdout=subprocess.PIPE, universal_newlines=True)
+
+    def run(self):
+        for line in self.process.stdout:
+            m = FRAME.search(line)
+            if m:
+                with self.lock:
+                    self.frames.append([int(v) for v in m.groups()])
+
+    def take(self):
+        with self.lock:
+            frames, self.frames = self.frames, []
+        return frames
+
+    def stop(self):
+        self.process.terminate()
+
+
+def read_sequence(path):
+    presses = []
+    with open(path) as f:
+        for line in f:
+            presses.extend(line.split('#', 1)[0].split())
+    for p in presses:
+        if p not in BUTTONS:
+            sys.exit('%s: unknown button "%s"' % (path, p))
+    return presses
+
+
+def press(platform, button):
+    args = ['pebble', 'emu-button']
+    if button == 'L':
+        subprocess.check_call(args + ['push', BUTTONS[button], '--emulator', platform], cwd=ROOT)
+        time.sleep(0.8)
+        subprocess.check_call(args + ['release', BUTTONS[button], '--emulator', platform], cwd=ROOT)
+    else:
+        subprocess.check_call(args + ['click', BUTTONS[button], '--emulator', platform], cwd=ROOT)
+
+
+def percentile(values, p):
+    if not values:
+        return 0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100.0))]
+
+
+def run_sequence(platform, reader, presses, settle):
+    """Returns per-press (latency, frames, blits, rules); latency is None if no frame answered the press."""
+    results = []
+    reader.take()
+    for button in presses:
+        press(platform, button)
+        time.sleep(settle)
+        frames = reader.take()
+        latency = next((f[0] for f in frames if f[0] >= 0), None)
+        results.append((latency, len(frames), sum(f[2] for f in frames), sum(f[3] for f in frames)))
+    return results
+
+
+def summarize(results):
+    latencies = [r[0] for r in results if r[0] is not None]
+    return {
+        'presses': len(results),
+        'answered': len(latencies),
+        'median_ms': percentile(latencies, 50),
+        'p90_ms': percentile(latencies, 90),
+        'max_ms': max(latencies) if latencies else 0,
+        'frames': sum(r[1] for r in results),
+        'blits': sum(r[2] for r in results),
+        'rules': sum(r[3] for r in results),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Replay button sequences in the Pebble emulator and time them.')
+    parser.add_argument('sequences', nargs='*', help='sequence files (default: tools/bench/sequences/*.txt)')
+    parser.add_argument('--platform', default='aplite')
+    parser.add_argument('--seeds', default='1,2,3')
+    parser.add_argument('--settle', type=float, default=0.6, help='seconds to wait after each press')
+    parser.add_argument('--baseline', default=os.path.join(HERE, 'baseline.json'))
+    parser.add_argument('--update-baseline', action='store_true')
+    parser.add_argument('--tolerance', type=float, default=20.0, help='allowed slowdown in percent')
+    parser.add_argument('--slack', type=int, default=2, help='slowdowns up to this many ms are ignored')
+    args = parser.parse_args()
+
+    sequences = args.sequences or sorted(glob.glob(os.path.join(HERE, 'sequences', '*.txt')))
+    summary = {}
+    for seed in [int(s) for s in args.seeds.split(',')]:
+        env = dict(os.environ, SOLITAIRE_CFLAGS='-DPROFILE -DBENCHMARK -DDEAL_SEED=%d' % seed)
+        subprocess.check_call(['pebble', 'build'], cwd=ROOT, env=env)
+        for path in sequences:
+            name = '%s/seed%d' % (os.path.splitext(os.path.basename(path))[0], seed)
+            # reinstalling restarts the app at its menu
+            subprocess.check_call(['pebble', 'install', '--emulator', args.platform], cwd=ROOT)
+            reader = LogReader(args.platform)
+            reader.start()
+            time.sleep(2)
+            try:
+                summary[name] = summarize(run_sequence(args.platform, reader, read_sequence(path), args.settle))
+            finally:
+                reader.stop()
+            s = summary[name]
+            print('%-24s presses=%3d answered=%3d median=%4dms p90=%4dms max=%4dms frames=%4d blits=%5d rules=%6d' % (
+                name, s['presses'], s['answered'], s['median_ms'], s['p90_ms'], s['max_ms'], s['frames'], s['blits'], s['rules']))
+
+    if args.update_baseline:
+        baseline = {}
+        if os.path.exists(args.baseline):
+            with open(args.baseline) as f:
+                baseline = json.load(f)
+        baseline.update(summary)
+        with open(args.baseline, 'w') as f:
+            json.dump(baseline, f, indent=2, sort_keys=True)
+            f.write('\n')
+        print('baseline written to %s' % args.baseline)
+        return 0
+    if not os.path.exists(args.baseline):
+        print('no baseline at %s; run with --update-baseline to store one' % args.baseline)
+        return 0
+
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+    regressions = 0
+    print('\nregression summary (current vs baseline)')
+    for name in sorted(summary):
+        if name not in baseline:
+            print('%-24s new' % name)
+            continue
+        for key in ('median_ms', 'p90_ms'):
+            old, new = baseline[name][key], summary[name][key]
+            slower = new - old > args.slack and new > old * (1 + args.tolerance / 100.0)
+            regressions += slower
+            print('%-24s %-9s %4d -> %4d %s' % (name, key, old, new, 'REGRESSION' if slower else 'ok'))
+    return 1 if regressions else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,372 @@
+/*
+fuzz.c -- differential fuzzer for the solitaire.c rules engine
+
+Copyright (c) 2014 Jeffry Johnston <pebble@kidsquid.com>
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+	fuzz [--runs N] [--length N] [--seed N]
+
+	Deals random games and plays random action sequences (replay encoding)
+	against the game logic in src/solitaire.c and the frozen copy in
+	reference.c in lockstep, comparing the whole board after every step.
+	About half the moves are drawn from the moves the reference allows, the
+	rest are any pile to any tableau pile or the foundations, so refused
+	moves are covered as well. The
+	first difference is shrunk to a shortest failing sequence, which is
+	printed with the board fields that differ. Reports executions (action
+	sequences) and steps per second.
+*/
+#include <pebble.h>
+#include <stdlib.h>
+#include "reference.h"
+
+static int host_deal_seed;
+#define DEAL_SEED host_deal_seed
+#define main solitaire_main
+#include "../../src/solitaire.c"
+#undef main
+
+#if VARIANT != VARIANT_KLONDIKE
+#error "reference.c holds the Klondike rules only"
+#endif
+
+#define MAX_LENGTH 4096
+
+typedef struct {
+	int seed;
+	int draw;
+	int fliplimit;
+	int length;
+	unsigned char actions[MAX_LENGTH];
+} Case;
+
+static uint32_t rng = 1;
+
+static int next_random(int max)
+{
+	rng = rng * 1103515245 + 12345;
+	return (int)((rng >> 8) % (uint32_t)max);
+}
+
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************************************************************************/
+/* Engine under test                                                          */
+/******************************************************************************/
+static void engine_deal(int deal_seed, int draw, int fliplimit)
+{
+	host_deal_seed = deal_seed;
+	draw_setting = draw;
+	fliplimit_setting = fliplimit;
+	score = 0;
+	shuffle_and_deal();
+}
+
+static bool engine_apply(int action)
+{
+	int i;
+
+	if (action < REPLAY_DEAL) {
+		source = action / REPLAY_PILES;
+		selection = action % REPLAY_PILES;
+		return (selection == PILE_FOUNDATIONS) ? move_to_foundation() : move_to_tableau();
+	} else if (action == REPLAY_DEAL) {
+		deal_card_from_stock();
+	} else if (action == REPLAY_AUTO_MOVE) {
+		auto_move_start();
+		while ((i = auto_move_next_pile()) >= 0) {
+			source = i;
+			move_to_foundation();
+		}
+	} else if (action < REPLAY_RESET_SCORE) {
+		if (draw_setting != (action - REPLAY_SETTINGS(0, 0)) / 4) {
+			toggle_draw_setting();
+		}
+		fliplimit_setting = (action - REPLAY_SETTINGS(0, 0)) % 4;
+	} else if (action == REPLAY_RESET_SCORE) {
+		score = 0;
+	}
+	return true;
+}
+
+/* same layout as reference_board() */
+static void engine_board(unsigned char *board)
+{
+	int i;
+	int j;
+
+	memset(board, 0xff, BOARD_SIZE);
+	board[0] = stock_count;
+	board[1] = talon;
+	board[2] = talon_showing;
+	board[3] = flips;
+	board[4] = draw_setting;
+	board[5] = fliplimit_setting;
+	board[6] = win;
+	memcpy(board + 7, &score, 4);
+	for (i = PILE_FOUNDATION_LEFT; i <= PILE_FOUNDATION_RIGHT; ++i) {
+		board[11 + i] = foundation[i];
+	}
+	for (i = PILE_TABLEAU_LEFT; i <= PILE_TABLEAU_RIGHT; ++i) {
+		board[15 + i] = hidden_count[i];
+		board[22 + i] = tableau_count[i];
+		for (j = 0; j < tableau_count[i]; ++j) {
+			board[BOARD_TABLEAU + i * 19 + j] = tableau[i][j];
+		}
+	}
+	for (i = 0; i < stock_count; ++i) {
+		board[BOARD_STOCK + i] = stock[i];
+	}
+}
+
+/******************************************************************************/
+/* Lockstep runs                                                              */
+/******************************************************************************/
+/* returns the index of the first step that differs, or -1 */
+static int run_case(const Case *c, unsigned char *engine, unsigned char *reference)
+{
+	int i;
+	bool engine_ok;
+	bool reference_ok;
+
+	engine_deal(c->seed, c->draw, c->fliplimit);
+	reference_deal(c->seed, c->draw, c->fliplimit);
+	engine_board(engine);
+	reference_board(reference);
+	if (memcmp(engine, reference, BOARD_SIZE) != 0) {
+		return 0;
+	}
+	for (i = 0; i < c->length; ++i) {
+		engine_ok = engine_apply(c->actions[i]);
+		reference_ok = reference_apply(c->actions[i]);
+		engine_board(engine);
+		reference_board(reference);
+		if (engine_ok != reference_ok || memcmp(engine, reference, BOARD_SIZE) != 0) {
+			return i + 1;
+		}
+	}
+	return -1;
+}
+
+static int random_action()
+{
+	static unsigned char legal[REPLAY_DEAL];
+	int n;
+	int r;
+
+	r = next_random(100);
+	if (r < 50) {
+		n = reference_legal_moves(legal);
+		if (n > 0) {
+			return legal[next_random(n)];
+		}
+	}
+	if (r < 80) {
+		// any source, any destination but the talon
+		n = next_random(TABLEAU_PILES + 1);
+		return REPLAY_MOVE(next_random(PILE_TALON + 1), (n == TABLEAU_PILES) ? PILE_FOUNDATIONS : n);
+	}
+	if (r < 94) {
+		return REPLAY_DEAL;
+	}
+	if (r < 97) {
+		return REPLAY_AUTO_MOVE;
+	}
+	if (r < 99) {
+		return REPLAY_SETTINGS(next_random(2), next_random(4));
+	}
+	return REPLAY_RESET_SCORE;
+}
+
+/* build a case while playing it, so legal moves come from the live reference */
+static int generate_case(Case *c, int length, unsigned char *engine, unsigned char *reference)
+{
+	int i;
+
+	c->seed = next_random(1 << 30);
+	c->draw = next_random(2);
+	c->fliplimit = next_random(4);
+	c->length = 0;
+	engine_deal(c->seed, c->draw, c->fliplimit);
+	reference_deal(c->seed, c->draw, c->fliplimit);
+	for (i = 0; i < length; ++i) {
+		c->actions[c->length++] = random_action();
+		if (engine_apply(c->actions[i]) != reference_apply(c->actions[i])) {
+			return i + 1;
+		}
+		engine_board(engine);
+		reference_board(reference);
+		if (memcmp(engine, reference, BOARD_SIZE) != 0) {
+			return i + 1;
+		}
+	}
+	return -1;
+}
+
+/*
+	Shrink a failing case: cut it at the failing step, then drop ever smaller
+	chunks of actions while it still fails, down to single actions, and
+	repeat until no single action can go.
+*/
+static void shrink_case(Case *c, int failed_at)
+{
+	static Case t;
+	unsigned char engine[BOARD_SIZE];
+	unsigned char reference[BOARD_SIZE];
+	int chunk;
+	int i;
+	int f;
+	int length;
+
+	c->length = failed_at;
+	do {
+		length = c->length;
+		for (chunk = c->length / 2; chunk >= 1; chunk /= 2) {
+			for (i = 0; i + chunk <= c->length; ) {
+				t = *c;
+				memmove(t.actions + i, t.actions + i + chunk, t.length - i - chunk);
+				t.length -= chunk;
+				f = run_case(&t, engine, reference);
+				if (f >= 0) {
+					t.length = f;
+					*c = t;
+				} else {
+					i += chunk;
+				}
+			}
+		}
+	} while (c->length < length);
+}
+
+static const char *board_field(int offset)
+{
+	static char name[32];
+	static const char *fields[] = {"stock_count", "talon", "talon_showing", "flips", "draw_setting",
+		"fliplimit_setting", "win"};
+
+	if (offset < 7) {
+		return fields[offset];
+	} else if (offset < 15) {
+		snprintf(name, sizeof(name), "foundation[%d]", offset - 11);
+	} else if (offset < 22) {
+		snprintf(name, sizeof(name), "hidden_count[%d]", offset - 15);
+	} else if (offset < BOARD_STOCK) {
+		snprintf(name, sizeof(name), "tableau_count[%d]", offset - 22);
+	} else if (offset < BOARD_TABLEAU) {
+		snprintf(name, sizeof(name), "stock[%d]", offset - BOARD_STOCK);
+	} else {
+		snprintf(name, sizeof(name), "tableau[%d][%d]", (offset - BOARD_TABLEAU) / 19, (offset - BOARD_TABLEAU) % 19);
+	}
+	return name;
+}
+
+static void report_case(const Case *c)
+{
+	unsigned char engine[BOARD_SIZE];
+	unsigned char reference[BOARD_SIZE];
+	int i;
+	bool engine_ok = true;
+	bool reference_ok = true;
+
+	printf("repro: seed %d draw %d fliplimit %d, %d actions:", c->seed, c->draw, c->fliplimit, c->length);
+	for (i = 0; i < c->length; ++i) {
+		printf(" %d", c->actions[i]);
+	}
+	printf("\n");
+
+	engine_deal(c->seed, c->draw, c->fliplimit);
+	reference_deal(c->seed, c->draw, c->fliplimit);
+	for (i = 0; i < c->length; ++i) {
+		engine_ok = engine_apply(c->actions[i]);
+		reference_ok = reference_apply(c->actions[i]);
+	}
+	engine_board(engine);
+	reference_board(reference);
+	if (engine_ok != reference_ok) {
+		printf("  last action: engine %s, reference %s\n", engine_ok ? "moved" : "refused",
+			reference_ok ? "moved" : "refused");
+	}
+	if (memcmp(engine + 7, reference + 7, 4) != 0) {
+		printf("  score: engine %d, reference %d\n", (int32_t)(engine[7] | engine[8] << 8 | engine[9] << 16 | engine[10] << 24),
+			(int32_t)(reference[7] | reference[8] << 8 | reference[9] << 16 | reference[10] << 24));
+	}
+	for (i = 0; i < BOARD_SIZE; ++i) {
+		if (engine[i] != reference[i] && (i < 7 || i >= 11)) {
+			printf("  %s: engine %d, reference %d\n", board_field(i), engine[i], reference[i]);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static Case c;
+	unsigned char engine[BOARD_SIZE];
+	unsigned char reference[BOARD_SIZE];
+	long runs = 20000;
+	int length = 300;
+	long run;
+	long steps = 0;
+	int failed_at = -1;
+	int i;
+	double start;
+	double elapsed;
+
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+			runs = atol(argv[++i]);
+		} else if (strcmp(argv[i], "--length") == 0 && i + 1 < argc) {
+			length = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+			rng = (uint32_t)atol(argv[++i]);
+		} else {
+			fprintf(stderr, "usage: %s [--runs N] [--length N] [--seed N]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (length < 1 || length > MAX_LENGTH) {
+		fprintf(stderr, "length must be 1-%d\n", MAX_LENGTH);
+		return 2;
+	}
+
+	start = now();
+	for (run = 0; run < runs; ++run) {
+		failed_at = generate_case(&c, length, engine, reference);
+		if (failed_at >= 0) {
+			steps += failed_at;
+			++run;
+			break;
+		}
+		steps += length;
+	}
+	elapsed = now() - start;
+	printf("%ld executions, %ld steps: %.0f executions/s, %.0f steps/s\n",
+		run, steps, run / elapsed, steps / elapsed);
+
+	if (failed_at >= 0) {
+		printf("engine and reference differ after %d actions; shrinking\n", failed_at);
+		shrink_case(&c, failed_at);
+		report_case(&c);
+		return 1;
+	}
+	printf("engine and reference agree\n");
+	return 0;
+}
@@ -0,0 +1,357 @@
+/*
+pebble.h -- host stand-in for the parts of the Pebble SDK used by solitaire.c
+
+Copyright (c) 2014 Jeffry Johnston <pebble@kidsquid.com>
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+	Host tools compile src/solitaire.c unchanged against this header, with
+	main renamed to solitaire_main. pebble_host.c implements the calls over a
+	1-bit framebuffer the size of the platform's screen (144x168, or 180x180
+	with PBL_ROUND, or 200x228 with PBL_PLATFORM_EMERY), an in-memory persistent store, a window stack
+	with click dispatch, app timers that run when host_run_timers() is
+	called, a clock that only the harness moves, and animations that finish
+	as soon as they are scheduled unless host_animation_stepping is set.
+	Like the watch, host_render() draws over the previous frame rather than
+	clearing it. Anything the game does not use is left out.
+*/
+#ifndef PEBBLE_HOST_H
+#define PEBBLE_HOST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/******************************************************************************/
+/* Geometry and graphics                                                      */
+/******************************************************************************/
+typedef struct {
+	int16_t x;
+	int16_t y;
+} GPoint;
+
+typedef struct {
+	int16_t w;
+	int16_t h;
+} GSize;
+
+typedef struct {
+	GPoint origin;
+	GSize size;
+} GRect;
+
+#define GPoint(x, y) ((GPoint) { (x), (y) })
+#define GSize(w, h) ((GSize) { (w), (h) })
+#define GRect(x, y, w, h) ((GRect) { { (x), (y) }, { (w), (h) } })
+#define GPointZero GPoint(0, 0)
+
+typedef struct {
+	uint8_t *addr;
+	uint16_t row_size_bytes;
+	uint16_t info_flags;
+	GRect bounds;
+} GBitmap;
+
+typedef enum {
+	GColorClear = ~0,
+	GColorBlack = 0,
+	GColorWhite = 1,
+} GColor;
+
+typedef enum {
+	GCornerNone = 0,
+} GCornerMask;
+
+typedef enum {
+	GTextAlignmentLeft,
+	GTextAlignmentCenter,
+	GTextAlignmentRight,
+} GTextAlignment;
+
+typedef enum {
+	GTextOverflowModeWordWrap,
+	GTextOverflowModeTrailingEllipsis,
+	GTextOverflowModeFill,
+} GTextOverflowMode;
+
+typedef struct GContext GContext;
+typedef const struct HostFont *GFont;
+typedef void *GTextLayoutCacheRef;
+
+#define FONT_KEY_GOTHIC_14 "GOTHIC_14"
+#define FONT_KEY_GOTHIC_18 "GOTHIC_18"
+#define FONT_KEY_GOTHIC_24_BOLD "GOTHIC_24_BOLD"
+
+GFont fonts_get_system_font(const char *font_key);
+
+void graphics_context_set_fill_color(GContext *ctx, GColor color);
+void graphics_context_set_text_color(GContext *ctx, GColor color);
+void graphics_fill_rect(GContext *ctx, GRect rect, uint16_t corner_radius, GCornerMask corner_mask);
+void graphics_draw_bitmap_in_rect(GContext *ctx, const GBitmap *bitmap, GRect rect);
+void graphics_draw_text(GContext *ctx, const char *text, GFont font, GRect box, GTextOverflowMode overflow_mode,
+	GTextAlignment alignment, GTextLayoutCacheRef layout);
+GSize graphics_text_layout_get_max_used_size(GContext *ctx, const char *text, GFont font, GRect box,
+	GTextOverflowMode overflow_mode, GTextAlignment alignment, GTextLayoutCacheRef layout);
+
+/******************************************************************************/
+/* Resources                                                                  */
+/******************************************************************************/
+/* same order as the media list in appinfo.json; pebble_host.c maps them to files */
+enum {
+	RESOURCE_ID_IMAGE_CARD = 1,
+	RESOURCE_ID_IMAGE_BACK,
+	RESOURCE_ID_IMAGE_EDGE,
+	RESOURCE_ID_IMAGE_SELECTOR,
+	RESOURCE_ID_IMAGE_MODE1,
+	RESOURCE_ID_IMAGE_A,
+	RESOURCE_ID_IMAGE_2,
+	RESOURCE_ID_IMAGE_3,
+	RESOURCE_ID_IMAGE_4,
+	RESOURCE_ID_IMAGE_5,
+	RESOURCE_ID_IMAGE_6,
+	RESOURCE_ID_IMAGE_7,
+	RESOURCE_ID_IMAGE_8,
+	RESOURCE_ID_IMAGE_9,
+	RESOURCE_ID_IMAGE_10,
+	RESOURCE_ID_IMAGE_J,
+	RESOURCE_ID_IMAGE_Q,
+	RESOURCE_ID_IMAGE_K,
+	RESOURCE_ID_IMAGE_SPADE,
+	RESOURCE_ID_IMAGE_CLUB,
+	RESOURCE_ID_IMAGE_HEART,
+	RESOURCE_ID_IMAGE_DIAMOND,
+	RESOURCE_ID_TEXT_HELP,
+	RESOURCE_ID_TEXT_ABOUT,
+	RESOURCE_ID_TEXT_HELP_THUMB_AND_POUCH,
+	RESOURCE_ID_TEXT_ABOUT_THUMB_AND_POUCH,
+	RESOURCE_ID_IMAGE_MENU_ICON,
+	RESOURCE_ID_COUNT,
+};
+
+typedef uint32_t ResHandle;
+
+GBitmap *gbitmap_create_with_resource(uint32_t resource_id);
+void gbitmap_destroy(GBitmap *bitmap);
+ResHandle resource_get_handle(uint32_t resource_id);
+size_t resource_size(ResHandle h);
+size_t resource_load_byte_range(ResHandle h, uint32_t start_offset, uint8_t *buffer, size_t num_bytes);
+
+/******************************************************************************/
+/* Layers and windows                                                         */
+/******************************************************************************/
+typedef struct Layer Layer;
+typedef struct TextLayer TextLayer;
+typedef struct Window Window;
+typedef struct SimpleMenuLayer SimpleMenuLayer;
+typedef void *ClickRecognizerRef;
+
+typedef void (*LayerUpdateProc)(Layer *layer, GContext *ctx);
+typedef void (*WindowHandler)(Window *window);
+typedef void (*ClickHandler)(ClickRecognizerRef recognizer, void *context);
+typedef void (*ClickConfigProvider)(void *context);
+typedef void (*SimpleMenuLayerSelectCallback)(int index, void *context);
+
+typedef struct {
+	WindowHandler load;
+	WindowHandler appear;
+	WindowHandler disappear;
+	WindowHandler unload;
+} WindowHandlers;
+
+typedef enum {
+	BUTTON_ID_BACK,
+	BUTTON_ID_UP,
+	BUTTON_ID_SELECT,
+	BUTTON_ID_DOWN,
+	NUM_BUTTONS,
+} ButtonId;
+
+typedef struct {
+	const char *title;
+	const char *subtitle;
+	GBitmap *icon;
+	SimpleMenuLayerSelectCallback callback;
+} SimpleMenuItem;
+
+typedef struct {
+	const char *title;
+	const SimpleMenuItem *items;
+	uint32_t num_items;
+} SimpleMenuSection;
+
+Layer *layer_create(GRect frame);
+void layer_destroy(Layer *layer);
+void layer_set_update_proc(Layer *layer, LayerUpdateProc update_proc);
+void layer_mark_dirty(Layer *layer);
+void layer_add_child(Layer *parent, Layer *child);
+void layer_remove_from_parent(Layer *child);
+GRect layer_get_frame(const Layer *layer);
+void layer_set_frame(Layer *layer, GRect frame);
+GRect layer_get_bounds(const Layer *layer);
+void layer_set_bounds(Layer *layer, GRect bounds);
+void layer_set_hidden(Layer *layer, bool hidden);
+
+TextLayer *text_layer_create(GRect frame);
+void text_layer_destroy(TextLayer *text_layer);
+Layer *text_layer_get_layer(TextLayer *text_layer);
+void text_layer_set_text(TextLayer *text_layer, const char *text);
+void text_layer_set_font(TextLayer *text_layer, GFont font);
+void text_layer_set_text_alignment(TextLayer *text_layer, GTextAlignment alignment);
+void text_layer_set_background_color(TextLayer *text_layer, GColor color);
+void text_layer_set_text_color(TextLayer *text_layer, GColor color);
+
+Window *window_create(void);
+void window_destroy(Window *window);
+Layer *window_get_root_layer(const Window *window);
+void window_set_window_handlers(Window *window, WindowHandlers handlers);
+void window_set_click_config_provider(Window *window, ClickConfigProvider click_config_provider);
+void window_single_click_subscribe(ButtonId button_id, ClickHandler handler);
+void window_long_click_subscribe(ButtonId button_id, uint16_t delay_ms, ClickHandler down_handler, ClickHandler up_handler);
+void window_stack_push(Window *window, bool animated);
+Window *window_stack_pop(bool animated);
+void window_stack_pop_all(bool animated);
+bool window_stack_remove(Window *window, bool animated);
+
+SimpleMenuLayer *simple_menu_layer_create(GRect frame, Window *window, const SimpleMenuSection *sections,
+	int32_t num_sections, void *callback_context);
+void simple_menu_layer_destroy(SimpleMenuLayer *menu_layer);
+Layer *simple_menu_layer_get_layer(const SimpleMenuLayer *menu_layer);
+
+/******************************************************************************/
+/* System services                                                            */
+/******************************************************************************/
+typedef enum {
+	APP_LOG_LEVEL_ERROR = 1,
+	APP_LOG_LEVEL_WARNING = 50,
+	APP_LOG_LEVEL_INFO = 100,
+	APP_LOG_LEVEL_DEBUG = 200,
+} AppLogLevel;
+
+#define APP_LOG(level, fmt, args...) app_log(level, __FILE__, __LINE__, fmt, ## args)
+void app_log(uint8_t log_level, const char *src_filename, int src_line_number, const char *fmt, ...);
+
+#define PERSIST_DATA_MAX_LENGTH 256
+int persist_read_data(uint32_t key, void *buffer, size_t buffer_size);
+int persist_write_data(uint32_t key, const void *data, size_t size);
+int32_t persist_read_int(uint32_t key);
+int persist_write_int(uint32_t key, int32_t value);
+bool persist_exists(uint32_t key);
+int persist_get_size(uint32_t key);
+int persist_delete(uint32_t key);
+
+typedef struct AppTimer AppTimer;
+typedef void (*AppTimerCallback)(void *data);
+AppTimer *app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *callback_data);
+bool app_timer_reschedule(AppTimer *timer, uint32_t new_timeout_ms);
+void app_timer_cancel(AppTimer *timer);
+
+/* one animation runs at a time; see host_animation_stepping */
+typedef struct Animation Animation;
+typedef uint32_t AnimationProgress;
+#define ANIMATION_NORMALIZED_MAX 65535
+
+typedef enum {
+	AnimationCurveLinear,
+	AnimationCurveEaseIn,
+	AnimationCurveEaseOut,
+	AnimationCurveEaseInOut,
+} AnimationCurve;
+
+typedef void (*AnimationStartedHandler)(Animation *animation, void *context);
+typedef void (*AnimationStoppedHandler)(Animation *animation, bool finished, void *context);
+typedef void (*AnimationSetupImplementation)(Animation *animation);
+typedef void (*AnimationUpdateImplementation)(Animation *animation, const AnimationProgress progress);
+typedef void (*AnimationTeardownImplementation)(Animation *animation);
+
+typedef struct {
+	AnimationStartedHandler started;
+	AnimationStoppedHandler stopped;
+} AnimationHandlers;
+
+typedef struct {
+	AnimationSetupImplementation setup;
+	AnimationUpdateImplementation update;
+	AnimationTeardownImplementation teardown;
+} AnimationImplementation;
+
+Animation *animation_create(void);
+bool animation_destroy(Animation *animation);
+bool animation_set_duration(Animation *animation, uint32_t duration_ms);
+bool animation_set_curve(Animation *animation, AnimationCurve curve);
+bool animation_set_implementation(Animation *animation, const AnimationImplementation *implementation);
+bool animation_set_handlers(Animation *animation, AnimationHandlers callbacks, void *context);
+bool animation_schedule(Animation *animation);
+bool animation_unschedule(Animation *animation);
+bool animation_is_scheduled(Animation *animation);
+
+uint16_t time_ms(time_t *tloc, uint16_t *out_ms);
+size_t heap_bytes_used(void);
+size_t heap_bytes_free(void);
+void vibes_short_pulse(void);
+void app_event_loop(void);
+
+/******************************************************************************/
+/* Host harness                                                               */
+/******************************************************************************/
+#if defined(PBL_ROUND)
+#define HOST_SCREEN_WIDTH 180
+#define HOST_SCREEN_HEIGHT 180
+#elif defined(PBL_PLATFORM_EMERY)
+#define HOST_SCREEN_WIDTH 200
+#define HOST_SCREEN_HEIGHT 228
+#else
+#define HOST_SCREEN_WIDTH 144
+#define HOST_SCREEN_HEIGHT 168
+#endif
+
+/* 1 byte per pixel, 0 = black, 1 = white */
+extern uint8_t host_framebuffer[HOST_SCREEN_HEIGHT][HOST_SCREEN_WIDTH];
+
+/* directory holding the resource files; defaults to "resources" */
+void host_set_resource_dir(const char *dir);
+/* draw the top window (with status bar) into host_framebuffer, over what is there */
+void host_render(void);
+/* host_render() if a layer has changed or been marked dirty since the last render; true if it did */
+bool host_render_dirty(void);
+/* deliver a click, or a long click, to the top window */
+void host_press(ButtonId button, bool long_press);
+/* fire every registered app timer whose callback has not run yet */
+void host_run_timers(void);
+/* drop all persisted keys */
+void host_persist_reset(void);
+/* write/read host_framebuffer as a binary PBM (P4) image; read returns false on mismatch or error */
+bool host_write_pbm(const char *path);
+bool host_compare_pbm(const char *path);
+/* number of bitmap blits since start */
+extern unsigned long host_blit_count;
+/* pixels drawn by bitmaps and text outside the round screen since start; always 0 on rectangular ones */
+extern unsigned long host_offscreen_pixels;
+/* what time_ms() reports, in ms; starts at 0 */
+extern uint32_t host_clock_ms;
+/* added to host_clock_ms by every bitmap blit, to model slow drawing; 0 by default */
+extern uint32_t host_blit_ms;
+/*
+	With host_animation_stepping set, a scheduled animation waits for
+	host_step_animation(), which moves the clock to its next frame (ms after
+	the last one, or now if drawing has already passed that) and updates it,
+	stopping it once its duration is over. Returns whether it still runs.
+*/
+extern bool host_animation_stepping;
+bool host_step_animation(uint32_t ms);
+
+#endif
@@ -0,0 +1,1270 @@
+/*
+pebble_host.c -- host implementation of the Pebble calls used by solitaire.c
+
+Copyright (c) 2014 Jeffry Johnston <pebble@kidsquid.com>
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <pebble.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <zlib.h>
+
+#if defined(PBL_ROUND)
+#define STATUS_BAR_HEIGHT 0 /* round apps draw to the whole screen */
+#else
+#define STATUS_BAR_HEIGHT 16
+#endif
+#define MAX_WINDOWS 8
+#define MAX_TIMERS 32
+#define MAX_PERSIST_KEYS 64
+
+/******************************************************************************/
+/* Globals                                                                    */
+/******************************************************************************/
+uint8_t host_framebuffer[HOST_SCREEN_HEIGHT][HOST_SCREEN_WIDTH];
+unsigned long host_blit_count;
+unsigned long host_offscreen_pixels;
+uint32_t host_clock_ms;
+uint32_t host_blit_ms;
+bool host_animation_stepping;
+
+struct GContext {
+	GRect clip; /* screen coordinates */
+	GPoint offset; /* screen position of the layer's bounds origin */
+	GColor fill_color;
+	GColor text_color;
+};
+
+struct HostFont {
+	const char *key;
+	int advance;
+	int line_height;
+	int scale;
+};
+
+static const struct HostFont fonts[] = {
+	{FONT_KEY_GOTHIC_14, 6, 14, 1},
+	{FONT_KEY_GOTHIC_18, 7, 18, 2},
+	{FONT_KEY_GOTHIC_24_BOLD, 10, 24, 3},
+};
+
+struct Layer {
+	GRect frame;
+	GRect bounds;
+	LayerUpdateProc update_proc;
+	Layer *parent;
+	Layer *first_child;
+	Layer *next_sibling;
+	bool hidden;
+	TextLayer *text_layer;
+	SimpleMenuLayer *menu_layer;
+};
+
+struct TextLayer {
+	Layer layer;
+	const char *text;
+	GFont font;
+	GTextAlignment alignment;
+	GColor background_color;
+	GColor text_color;
+};
+
+struct SimpleMenuLayer {
+	Layer layer;
+	const SimpleMenuSection *sections;
+	int32_t num_sections;
+};
+
+struct Window {
+	Layer root;
+	WindowHandlers handlers;
+	ClickConfigProvider click_config_provider;
+	ClickHandler single[NUM_BUTTONS];
+	ClickHandler long_down[NUM_BUTTONS];
+	bool loaded;
+};
+
+struct AppTimer {
+	AppTimerCallback callback;
+	void *data;
+	bool active;
+};
+
+static const char *resource_dir = "resources";
+static const char *resource_files[RESOURCE_ID_COUNT] = {
+	[RESOURCE_ID_IMAGE_CARD] = "card.png",
+	[RESOURCE_ID_IMAGE_BACK] = "back.png",
+	[RESOURCE_ID_IMAGE_EDGE] = "edge.png",
+	[RESOURCE_ID_IMAGE_SELECTOR] = "selector.png",
+	[RESOURCE_ID_IMAGE_MODE1] = "mode1.png",
+	[RESOURCE_ID_IMAGE_A] = "A.png",
+	[RESOURCE_ID_IMAGE_2] = "2.png",
+	[RESOURCE_ID_IMAGE_3] = "3.png",
+	[RESOURCE_ID_IMAGE_4] = "4.png",
+	[RESOURCE_ID_IMAGE_5] = "5.png",
+	[RESOURCE_ID_IMAGE_6] = "6.png",
+	[RESOURCE_ID_IMAGE_7] = "7.png",
+	[RESOURCE_ID_IMAGE_8] = "8.png",
+	[RESOURCE_ID_IMAGE_9] = "9.png",
+	[RESOURCE_ID_IMAGE_10] = "10.png",
+	[RESOURCE_ID_IMAGE_J] = "J.png",
+	[RESOURCE_ID_IMAGE_Q] = "Q.png",
+	[RESOURCE_ID_IMAGE_K] = "K.png",
+	[RESOURCE_ID_IMAGE_SPADE] = "spade.png",
+	[RESOURCE_ID_IMAGE_CLUB] = "club.png",
+	[RESOURCE_ID_IMAGE_HEART] = "heart.png",
+	[RESOURCE_ID_IMAGE_DIAMOND] = "diamond.png",
+	[RESOURCE_ID_TEXT_HELP] = "help.txt",
+	[RESOURCE_ID_TEXT_ABOUT] = "about.txt",
+	[RESOURCE_ID_TEXT_HELP_THUMB_AND_POUCH] = "help_thumb_and_pouch.txt",
+	[RESOURCE_ID_TEXT_ABOUT_THUMB_AND_POUCH] = "about_thumb_and_pouch.txt",
+	[RESOURCE_ID_IMAGE_MENU_ICON] = "logo.png",
+};
+static uint8_t *resource_data[RESOURCE_ID_COUNT];
+static size_t resource_length[RESOURCE_ID_COUNT];
+
+static Window *window_stack[MAX_WINDOWS];
+static int window_count;
+static Window *configuring_window;
+static bool dirty;
+
+static struct AppTimer timers[MAX_TIMERS];
+
+static uint8_t persist_data[MAX_PERSIST_KEYS][PERSIST_DATA_MAX_LENGTH];
+static int persist_size[MAX_PERSIST_KEYS]; /* -1: key does not exist */
+static bool persist_initialized;
+
+/******************************************************************************/
+/* Resources                                                                  */
+/******************************************************************************/
+void host_set_resource_dir(const char *dir)
+{
+	resource_dir = dir;
+}
+
+static bool load_resource(uint32_t id)
+{
+	char path[512];
+	FILE *f;
+	long size;
+
+	if (id == 0 || id >= RESOURCE_ID_COUNT || resource_files[id] == NULL) {
+		return false;
+	}
+	if (resource_data[id] != NULL) {
+		return true;
+	}
+	snprintf(path, sizeof(path), "%s/%s", resource_dir, resource_files[id]);
+	f = fopen(path, "rb");
+	if (f == NULL) {
+		fprintf(stderr, "pebble_host: cannot open %s\n", path);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	resource_data[id] = malloc(size > 0 ? size : 1);
+	resource_length[id] = fread(resource_data[id], 1, size, f);
+	fclose(f);
+	return true;
+}
+
+ResHandle resource_get_handle(uint32_t resource_id)
+{
+	return load_resource(resource_id) ? resource_id : 0;
+}
+
+size_t resource_size(ResHandle h)
+{
+	return (h != 0) ? resource_length[h] : 0;
+}
+
+size_t resource_load_byte_range(ResHandle h, uint32_t start_offset, uint8_t *buffer, size_t num_bytes)
+{
+	if (h == 0 || start_offset >= resource_length[h]) {
+		return 0;
+	}
+	if (num_bytes > resource_length[h] - start_offset) {
+		num_bytes = resource_length[h] - start_offset;
+	}
+	memcpy(buffer, resource_data[h] + start_offset, num_bytes);
+	return num_bytes;
+}
+
+static uint32_t be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static int paeth(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = abs(p - a);
+	int pb = abs(p - b);
+	int pc = abs(p - c);
+
+	if (pa <= pb && pa <= pc) {
+		return a;
+	}
+	return (pb <= pc) ? b : c;
+}
+
+/* Decode a non-interlaced palette or grayscale PNG of 1 to 8 bits per pixel into a 1-bit GBitmap */
+GBitmap *gbitmap_create_with_resource(uint32_t resource_id)
+{
+	const uint8_t *png;
+	const uint8_t *chunk;
+	uint8_t *idat = NULL;
+	size_t idat_length = 0;
+	uint8_t white[256];
+	uint8_t *raw;
+	uLongf raw_length;
+	int width = 0;
+	int height = 0;
+	int depth = 0;
+	int color_type = 0;
+	int stride;
+	int x;
+	int y;
+	int i;
+	GBitmap *bitmap;
+
+	if (!load_resource(resource_id)) {
+		return NULL;
+	}
+	png = resource_data[resource_id];
+	for (i = 0; i < 256; ++i) {
+		white[i] = (uint8_t)(i != 0);
+	}
+	for (chunk = png + 8; chunk + 12 <= png + resource_length[resource_id]; chunk += 12 + be32(chunk)) {
+		uint32_t length = be32(chunk);
+		const uint8_t *data = chunk + 8;
+		if (memcmp(chunk + 4, "IHDR", 4) == 0) {
+			width = be32(data);
+			height = be32(data + 4);
+			depth = data[8];
+			color_type = data[9];
+		} else if (memcmp(chunk + 4, "PLTE", 4) == 0) {
+			for (i = 0; i < (int)length / 3; ++i) {
+				white[i] = (uint8_t)(data[3 * i] + data[3 * i + 1] + data[3 * i + 2] >= 3 * 128);
+			}
+		} else if (memcmp(chunk + 4, "IDAT", 4) == 0) {
+			idat = realloc(idat, idat_length + length);
+			memcpy(idat + idat_length, data, length);
+			idat_length += length;
+		}
+	}
+	if (color_type == 0) {
+		for (i = 0; i < 256; ++i) {
+			white[i] = (uint8_t)(i >= (1 << depth) / 2);
+		}
+	}
+
+	stride = (width * depth + 7) / 8;
+	raw_length = (uLongf)(stride + 1) * height;
+	raw = malloc(raw_length);
+	if (uncompress(raw, &raw_length, idat, idat_length) != Z_OK) {
+		fprintf(stderr, "pebble_host: cannot decode %s\n", resource_files[resource_id]);
+		exit(1);
+	}
+	free(idat);
+
+	// undo the per-row filters in place
+	for (y = 0; y < height; ++y) {
+		uint8_t *row = raw + y * (stride + 1);
+		uint8_t *prior = (y > 0) ? row - (stride + 1) : NULL;
+		for (x = 1; x <= stride; ++x) {
+			int a = (x > 1) ? row[x - 1] : 0;
+			int b = prior ? prior[x] : 0;
+			int c = (prior && x > 1) ? prior[x - 1] : 0;
+			switch (row[0]) {
+			case 1: row[x] += a; break;
+			case 2: row[x] += b; break;
+			case 3: row[x] += (a + b) / 2; break;
+			case 4: row[x] += paeth(a, b, c); break;
+			}
+		}
+	}
+
+	bitmap = calloc(1, sizeof(GBitmap));
+	bitmap->row_size_bytes = (uint16_t)(((width + 31) / 32) * 4);
+	bitmap->bounds = GRect(0, 0, width, height);
+	bitmap->addr = calloc(bitmap->row_size_bytes, height);
+	for (y = 0; y < height; ++y) {
+		const uint8_t *row = raw + y * (stride + 1) + 1;
+		for (x = 0; x < width; ++x) {
+			int bit = x * depth;
+			int v = (row[bit / 8] >> (8 - depth - bit % 8)) & ((1 << depth) - 1);
+			if (white[v]) {
+				// Pebble bitmaps are LSB first, 1 = white
+				bitmap->addr[y * bitmap->row_size_bytes + x / 8] |= (uint8_t)(1 << (x % 8));
+			}
+		}
+	}
+	free(raw);
+	return bitmap;
+}
+
+void gbitmap_destroy(GBitmap *bitmap)
+{
+	if (bitmap != NULL) {
+		free(bitmap->addr);
+		free(bitmap);
+	}
+}
+
+/******************************************************************************/
+/* Drawing                                                                    */
+/******************************************************************************/
+static GRect intersect(GRect a, GRect b)
+{
+	int x0 = (a.origin.x > b.origin.x) ? a.origin.x : b.origin.x;
+	int y0 = (a.origin.y > b.origin.y) ? a.origin.y : b.origin.y;
+	int x1 = (a.origin.x + a.size.w < b.origin.x + b.size.w) ? a.origin.x + a.size.w : b.origin.x + b.size.w;
+	int y1 = (a.origin.y + a.size.h < b.origin.y + b.size.h) ? a.origin.y + a.size.h : b.origin.y + b.size.h;
+
+	return GRect(x0, y0, (x1 > x0) ? x1 - x0 : 0, (y1 > y0) ? y1 - y0 : 0);
+}
+
+static void set_pixel(GContext *ctx, int x, int y, int white)
+{
+	x += ctx->offset.x;
+	y += ctx->offset.y;
+	if (x >= ctx->clip.origin.x && x < ctx->clip.origin.x + ctx->clip.size.w
+			&& y >= ctx->clip.origin.y && y < ctx->clip.origin.y + ctx->clip.size.h) {
+		host_framebuffer[y][x] = (uint8_t)white;
+#if defined(PBL_ROUND)
+		// pixel centers further than the radius from the center are not on the display
+		if ((2 * x + 1 - HOST_SCREEN_WIDTH) * (2 * x + 1 - HOST_SCREEN_WIDTH)
+				+ (2 * y + 1 - HOST_SCREEN_HEIGHT) * (2 * y + 1 - HOST_SCREEN_HEIGHT) > HOST_SCREEN_WIDTH * HOST_SCREEN_WIDTH) {
+			++host_offscreen_pixels;
+		}
+#endif
+	}
+}
+
+void graphics_context_set_fill_color(GContext *ctx, GColor color)
+{
+	ctx->fill_color = color;
+}
+
+void graphics_context_set_text_color(GContext *ctx, GColor color)
+{
+	ctx->text_color = color;
+}
+
+void graphics_fill_rect(GContext *ctx, GRect rect, uint16_t corner_radius, GCornerMask corner_mask)
+{
+	GRect r;
+	int y;
+
+	if (ctx->fill_color == GColorClear) {
+		return;
+	}
+	rect.origin.x += ctx->offset.x;
+	rect.origin.y += ctx->offset.y;
+	r = intersect(rect, ctx->clip);
+	for (y = r.origin.y; y < r.origin.y + r.size.h; ++y) {
+		memset(&host_framebuffer[y][r.origin.x], ctx->fill_color == GColorWhite, r.size.w);
+	}
+}
+
+/* GCompOpAssign: copy every pixel, tiling the bitmap if rect is larger */
+void graphics_draw_bitmap_in_rect(GContext *ctx, const GBitmap *bitmap, GRect rect)
+{
+	int x;
+	int y;
+	int bx;
+	int by;
+
+	++host_blit_count;
+	host_clock_ms += host_blit_ms;
+	if (bitmap->bounds.size.w <= 0 || bitmap->bounds.size.h <= 0) {
+		return;
+	}
+	for (y = 0; y < rect.size.h; ++y) {
+		by = bitmap->bounds.origin.y + y % bitmap->bounds.size.h;
+		for (x = 0; x < rect.size.w; ++x) {
+			bx = bitmap->bounds.origin.x + x % bitmap->bounds.size.w;
+			set_pixel(ctx, rect.origin.x + x, rect.origin.y + y, (bitmap->addr[by * bitmap->row_size_bytes + bx / 8] >> (bx % 8)) & 1);
+		}
+	}
+}
+
+/******************************************************************************/
+/* Text                                                                       */
+/******************************************************************************/
+/*
+	Text is drawn with a 3x5 font, scaled per system font. Digits and the few
+	symbols used by the score have real glyphs; any other printable character
+	is a solid block, which keeps text layout and placement visible in golden
+	images without carrying a full font.
+*/
+static const char glyph_chars[] = "0123456789$-+:/.%";
+static const uint8_t glyph_rows[][5] = {
+	{7, 5, 5, 5, 7}, {2, 6, 2, 2, 7}, {7, 1, 7, 4, 7}, {7, 1, 3, 1, 7}, {5, 5, 7, 1, 1},
+	{7, 4, 7, 1, 7}, {7, 4, 7, 5, 7}, {7, 1, 1, 2, 2}, {7, 5, 7, 5, 7}, {7, 5, 7, 1, 7},
+	{7, 6, 7, 3, 7}, {0, 0, 7, 0, 0}, {0, 2, 7, 2, 0}, {0, 2, 0, 2, 0}, {1, 1, 2, 4, 4},
+	{0, 0, 0, 0, 2}, {5, 1, 2, 4, 5},
+};
+
+GFont fonts_get_system_font(const char *font_key)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(fonts) / sizeof(fonts[0]); ++i) {
+		if (strcmp(fonts[i].key, font_key) == 0) {
+			return &fonts[i];
+		}
+	}
+	return &fonts[0];
+}
+
+static void draw_glyph(GContext *ctx, int x, int y, char c, GFont font)
+{
+	const char *g = strchr(glyph_chars, c);
+	int row;
+	int col;
+	int bits;
+
+	if (c == ' ' || c == '\0') {
+		return;
+	}
+	for (row = 0; row < 5 * font->scale; ++row) {
+		bits = g ? glyph_rows[g - glyph_chars][row / font->scale] : 7;
+		for (col = 0; col < 3 * font->scale; ++col) {
+			if (bits & (4 >> (col / font->scale))) {
+				set_pixel(ctx, x + col, y + row, ctx->text_color == GColorWhite);
+			}
+		}
+	}
+}
+
+/* Greedy word wrap; calls emit (if set) per line and returns the number of lines */
+static int layout_text(const char *text, GFont font, int width, int *max_width,
+	void (*emit)(const char *line, int length, int index, void *data), void *data)
+{
+	const char *line = text;
+	const char *p;
+	const char *word_end;
+	const char *end;
+	int columns = (width / font->advance > 0) ? width / font->advance : 1;
+	int lines = 0;
+	int length;
+
+	*max_width = 0;
+	while (*line != '\0') {
+		// extend the line word by word while it fits; break overlong words
+		end = line;
+		for (p = line; *p != '\0' && *p != '\n'; p = (*word_end == ' ') ? word_end + 1 : word_end) {
+			for (word_end = p; *word_end != '\0' && *word_end != '\n' && *word_end != ' '; ++word_end) {
+			}
+			if (word_end - line > columns) {
+				if (end == line) {
+					end = line + columns;
+				}
+				break;
+			}
+			end = word_end;
+		}
+		length = (int)(end - line);
+		if (emit) {
+			emit(line, length, lines, data);
+		}
+		if (length * font->advance > *max_width) {
+			*max_width = length * font->advance;
+		}
+		++lines;
+		line = end;
+		while (*line == ' ') {
+			++line;
+		}
+		if (*line == '\n') {
+			++line;
+		}
+	}
+	return lines;
+}
+
+struct DrawTextState {
+	GContext *ctx;
+	GFont font;
+	GRect box;
+	GTextAlignment alignment;
+};
+
+static void draw_text_line(const char *line, int length, int index, void *data)
+{
+	struct DrawTextState *state = data;
+	int x = state->box.origin.x;
+	int y = state->box.origin.y + index * state->font->line_height + (state->font->line_height - 5 * state->font->scale) / 2;
+	int i;
+
+	if ((index + 1) * state->font->line_height > state->box.size.h) {
+		return;
+	}
+	if (state->alignment == GTextAlignmentRight) {
+		x += state->box.size.w - length * state->font->advance;
+	} else if (state->alignment == GTextAlignmentCenter) {
+		x += (state->box.size.w - length * state->font->advance) / 2;
+	}
+	for (i = 0; i < length; ++i) {
+		draw_glyph(state->ctx, x + i * state->font->advance, y, line[i], state->font);
+	}
+}
+
+void graphics_draw_text(GContext *ctx, const char *text, GFont font, GRect box, GTextOverflowMode overflow_mode,
+	GTextAlignment alignment, GTextLayoutCacheRef layout)
+{
+	struct DrawTextState state = {ctx, font, box, alignment};
+	int max_width;
+
+	layout_text(text, font, box.size.w, &max_width, draw_text_line, &state);
+}
+
+/* like the watch, the used height is clipped to the box */
+GSize graphics_text_layout_get_max_used_size(GContext *ctx, const char *text, GFont font, GRect box,
+	GTextOverflowMode overflow_mode, GTextAlignment alignment, GTextLayoutCacheRef layout)
+{
+	int max_width;
+	int height = layout_text(text, font, box.size.w, &max_width, NULL, NULL) * font->line_height;
+
+	return GSize(max_width, (height < box.size.h) ? height : box.size.h);
+}
+
+/******************************************************************************/
+/* Layers                                                                     */
+/******************************************************************************/
+static void layer_init(Layer *layer, GRect frame)
+{
+	memset(layer, 0, sizeof(*layer));
+	layer->frame = frame;
+	layer->bounds = GRect(0, 0, frame.size.w, frame.size.h);
+}
+
+Layer *layer_create(GRect frame)
+{
+	Layer *layer = malloc(sizeof(Layer));
+
+	layer_init(layer, frame);
+	return layer;
+}
+
+void layer_remove_from_parent(Layer *child)
+{
+	Layer **link;
+
+	if (child->parent == NULL) {
+		return;
+	}
+	for (link = &child->parent->first_child; *link != NULL; link = &(*link)->next_sibling) {
+		if (*link == child) {
+			*link = child->next_sibling;
+			break;
+		}
+	}
+	child->parent = NULL;
+	child->next_sibling = NULL;
+}
+
+void layer_destroy(Layer *layer)
+{
+	layer_remove_from_parent(layer);
+	free(layer);
+}
+
+void layer_set_update_proc(Layer *layer, LayerUpdateProc update_proc)
+{
+	layer->update_proc = update_proc;
+}
+
+void layer_mark_dirty(Layer *layer)
+{
+	dirty = true;
+}
+
+void layer_add_child(Layer *parent, Layer *child)
+{
+	Layer **link;
+
+	layer_remove_from_parent(child);
+	for (link = &parent->first_child; *link != NULL; link = &(*link)->next_sibling) {
+	}
+	*link = child;
+	child->parent = parent;
+}
+
+GRect layer_get_frame(const Layer *layer)
+{
+	return layer->frame;
+}
+
+void layer_set_frame(Layer *layer, GRect frame)
+{
+	dirty = true;
+	layer->frame = frame;
+	layer->bounds.size = frame.size;
+}
+
+GRect layer_get_bounds(const Layer *layer)
+{
+	return layer->bounds;
+}
+
+void layer_set_bounds(Layer *layer, GRect bounds)
+{
+	layer->bounds = bounds;
+}
+
+void layer_set_hidden(Layer *layer, bool hidden)
+{
+	dirty = true;
+	layer->hidden = hidden;
+}
+
+TextLayer *text_layer_create(GRect frame)
+{
+	TextLayer *text_layer = calloc(1, sizeof(TextLayer));
+
+	layer_init(&text_layer->layer, frame);
+	text_layer->layer.text_layer = text_layer;
+	text_layer->font = &fonts[0];
+	text_layer->background_color = GColorWhite;
+	text_layer->text_color = GColorBlack;
+	return text_layer;
+}
+
+void text_layer_destroy(TextLayer *text_layer)
+{
+	layer_remove_from_parent(&text_layer->layer);
+	free(text_layer);
+}
+
+Layer *text_layer_get_layer(TextLayer *text_layer)
+{
+	return &text_layer->layer;
+}
+
+void text_layer_set_text(TextLayer *text_layer, const char *text)
+{
+	text_layer->text = text;
+}
+
+void text_layer_set_font(TextLayer *text_layer, GFont font)
+{
+	text_layer->font = font;
+}
+
+void text_layer_set_text_alignment(TextLayer *text_layer, GTextAlignment alignment)
+{
+	text_layer->alignment = alignment;
+}
+
+void text_layer_set_background_color(TextLayer *text_layer, GColor color)
+{
+	text_layer->background_color = color;
+}
+
+void text_layer_set_text_color(TextLayer *text_layer, GColor color)
+{
+	text_layer->text_color = color;
+}
+
+static void draw_text_layer(TextLayer *text_layer, GContext *ctx)
+{
+	graphics_context_set_fill_color(ctx, text_layer->background_color);
+	graphics_fill_rect(ctx, text_layer->layer.bounds, 0, GCornerNone);
+	if (text_layer->text != NULL) {
+		graphics_context_set_text_color(ctx, text_layer->text_color);
+		graphics_draw_text(ctx, text_layer->text, text_layer->font, text_layer->layer.bounds,
+			GTextOverflowModeWordWrap, text_layer->alignment, NULL);
+	}
+}
+
+SimpleMenuLayer *simple_menu_layer_create(GRect frame, Window *window, const SimpleMenuSection *sections,
+	int32_t num_sections, void *callback_context)
+{
+	SimpleMenuLayer *menu_layer = calloc(1, sizeof(SimpleMenuLayer));
+
+	layer_init(&menu_layer->layer, frame);
+	menu_layer->layer.menu_layer = menu_layer;
+	menu_layer->sections = sections;
+	menu_layer->num_sections = num_sections;
+	return menu_layer;
+}
+
+void simple_menu_layer_destroy(SimpleMenuLayer *menu_layer)
+{
+	layer_remove_from_parent(&menu_layer->layer);
+	free(menu_layer);
+}
+
+Layer *simple_menu_layer_get_layer(const SimpleMenuLayer *menu_layer)
+{
+	return (Layer *)&menu_layer->layer;
+}
+
+static void draw_menu_layer(SimpleMenuLayer *menu_layer, GContext *ctx)
+{
+	int32_t i;
+	uint32_t j;
+	int y = 0;
+
+	graphics_context_set_fill_color(ctx, GColorWhite);
+	graphics_fill_rect(ctx, menu_layer->layer.bounds, 0, GCornerNone);
+	graphics_context_set_text_color(ctx, GColorBlack);
+	for (i = 0; i < menu_layer->num_sections; ++i, y += 14) {
+		graphics_draw_text(ctx, menu_layer->sections[i].title, &fonts[0], GRect(2, y, 140, 14),
+			GTextOverflowModeTrailingEllipsis, GTextAlignmentLeft, NULL);
+		for (j = 0; j < menu_layer->sections[i].num_items; ++j) {
+			y += 14;
+			graphics_draw_text(ctx, menu_layer->sections[i].items[j].title, &fonts[0], GRect(8, y, 132, 14),
+				GTextOverflowModeTrailingEllipsis, GTextAlignmentLeft, NULL);
+		}
+	}
+}
+
+static void render_layer(Layer *layer, GPoint parent_origin, GRect parent_clip)
+{
+	GContext ctx;
+	Layer *child;
+	GPoint origin = GPoint(parent_origin.x + layer->frame.origin.x, parent_origin.y + layer->frame.origin.y);
+
+	if (layer->hidden) {
+		return;
+	}
+	ctx.clip = intersect(parent_clip, GRect(origin.x, origin.y, layer->frame.size.w, layer->frame.size.h));
+	ctx.offset = GPoint(origin.x + layer->bounds.origin.x, origin.y + layer->bounds.origin.y);
+	ctx.fill_color = GColorBlack;
+	ctx.text_color = GColorBlack;
+	if (layer->text_layer != NULL) {
+		draw_text_layer(layer->text_layer, &ctx);
+	} else if (layer->menu_layer != NULL) {
+		draw_menu_layer(layer->menu_layer, &ctx);
+	} else if (layer->update_proc != NULL) {
+		layer->update_proc(layer, &ctx);
+	}
+	for (child = layer->first_child; child != NULL; child = child->next_sibling) {
+		render_layer(child, ctx.offset, ctx.clip);
+	}
+}
+
+/******************************************************************************/
+/* Windows                                                                    */
+/******************************************************************************/
+Window *window_create(void)
+{
+	Window *window = calloc(1, sizeof(Window));
+
+	layer_init(&window->root, GRect(0, STATUS_BAR_HEIGHT, HOST_SCREEN_WIDTH, HOST_SCREEN_HEIGHT - STATUS_BAR_HEIGHT));
+	return window;
+}
+
+void window_destroy(Window *window)
+{
+	free(window);
+}
+
+Layer *window_get_root_layer(const Window *window)
+{
+	return (Layer *)&window->root;
+}
+
+void window_set_window_handlers(Window *window, WindowHandlers handlers)
+{
+	window->handlers = handlers;
+}
+
+void window_set_click_config_provider(Window *window, ClickConfigProvider click_config_provider)
+{
+	window->click_config_provider = click_config_provider;
+}
+
+void window_single_click_subscribe(ButtonId button_id, ClickHandler handler)
+{
+	configuring_window->single[button_id] = handler;
+}
+
+void window_long_click_subscribe(ButtonId button_id, uint16_t delay_ms, ClickHandler down_handler, ClickHandler up_handler)
+{
+	configuring_window->long_down[button_id] = down_handler;
+}
+
+static void configure_clicks(Window *window)
+{
+	memset(window->single, 0, sizeof(window->single));
+	memset(window->long_down, 0, sizeof(window->long_down));
+	if (window->click_config_provider != NULL) {
+		configuring_window = window;
+		window->click_config_provider(NULL);
+		configuring_window = NULL;
+	}
+}
+
+void window_stack_push(Window *window, bool animated)
+{
+	if (window_count == MAX_WINDOWS) {
+		fprintf(stderr, "pebble_host: window stack overflow\n");
+		exit(1);
+	}
+	window_stack[window_count++] = window;
+	if (!window->loaded) {
+		window->loaded = true;
+		if (window->handlers.load != NULL) {
+			window->handlers.load(window);
+		}
+	}
+	configure_clicks(window);
+}
+
+bool window_stack_remove(Window *window, bool animated)
+{
+	int i;
+
+	for (i = 0; i < window_count && window_stack[i] != window; ++i) {
+	}
+	if (i == window_count) {
+		return false;
+	}
+	memmove(&window_stack[i], &window_stack[i + 1], (window_count - i - 1) * sizeof(Window *));
+	--window_count;
+	window->loaded = false;
+	if (window->handlers.unload != NULL) {
+		window->handlers.unload(window);
+	}
+	return true;
+}
+
+Window *window_stack_pop(bool animated)
+{
+	Window *window;
+
+	if (window_count == 0) {
+		return NULL;
+	}
+	window = window_stack[window_count - 1];
+	window_stack_remove(window, animated);
+	return window;
+}
+
+void window_stack_pop_all(bool animated)
+{
+	while (window_count > 0) {
+		window_stack_pop(animated);
+	}
+}
+
+void host_render(void)
+{
+	GRect screen = GRect(0, 0, HOST_SCREEN_WIDTH, HOST_SCREEN_HEIGHT);
+
+	dirty = false;
+	if (window_count > 0) {
+		render_layer(&window_stack[window_count - 1]->root, GPointZero, screen);
+	}
+}
+
+bool host_render_dirty(void)
+{
+	if (!dirty) {
+		return false;
+	}
+	host_render();
+	return true;
+}
+
+void host_press(ButtonId button, bool long_press)
+{
+	Window *window;
+
+	if (window_count == 0) {
+		return;
+	}
+	window = window_stack[window_count - 1];
+	if (long_press && window->long_down[button] != NULL) {
+		window->long_down[button](NULL, window);
+	} else if (window->single[button] != NULL) {
+		window->single[button](NULL, window);
+	} else if (button == BUTTON_ID_BACK) {
+		window_stack_pop(true);
+	}
+}
+
+/******************************************************************************/
+/* System services                                                            */
+/******************************************************************************/
+void app_log(uint8_t log_level, const char *src_filename, int src_line_number, const char *fmt, ...)
+{
+	va_list args;
+
+	fprintf(stderr, "%s:%d> ", src_filename, src_line_number);
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fputc('\n', stderr);
+}
+
+static void persist_init(void)
+{
+	if (!persist_initialized) {
+		host_persist_reset();
+	}
+}
+
+void host_persist_reset(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_PERSIST_KEYS; ++i) {
+		persist_size[i] = -1;
+	}
+	persist_initialized = true;
+}
+
+int persist_read_data(uint32_t key, void *buffer, size_t buffer_size)
+{
+	persist_init();
+	if (key >= MAX_PERSIST_KEYS || persist_size[key] < 0) {
+		return -1;
+	}
+	if (buffer_size > (size_t)persist_size[key]) {
+		buffer_size = persist_size[key];
+	}
+	memcpy(buffer, persist_data[key], buffer_size);
+	return (int)buffer_size;
+}
+
+int persist_write_data(uint32_t key, const void *data, size_t size)
+{
+	persist_init();
+	if (key >= MAX_PERSIST_KEYS) {
+		return -1;
+	}
+	if (size > PERSIST_DATA_MAX_LENGTH) {
+		size = PERSIST_DATA_MAX_LENGTH;
+	}
+	memcpy(persist_data[key], data, size);
+	persist_size[key] = (int)size;
+	return (int)size;
+}
+
+int32_t persist_read_int(uint32_t key)
+{
+	int32_t value = 0;
+
+	persist_read_data(key, &value, sizeof(value));
+	return value;
+}
+
+int persist_write_int(uint32_t key, int32_t value)
+{
+	return persist_write_data(key, &value, sizeof(value));
+}
+
+bool persist_exists(uint32_t key)
+{
+	persist_init();
+	return key < MAX_PERSIST_KEYS && persist_size[key] >= 0;
+}
+
+int persist_get_size(uint32_t key)
+{
+	return persist_exists(key) ? persist_size[key] : -1;
+}
+
+int persist_delete(uint32_t key)
+{
+	persist_init();
+	if (key < MAX_PERSIST_KEYS) {
+		persist_size[key] = -1;
+	}
+	return 0;
+}
+
+AppTimer *app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *callback_data)
+{
+	int i;
+
+	for (i = 0; i < MAX_TIMERS; ++i) {
+		if (!timers[i].active) {
+			timers[i].callback = callback;
+			timers[i].data = callback_data;
+			timers[i].active = true;
+			return &timers[i];
+		}
+	}
+	fprintf(stderr, "pebble_host: out of timers\n");
+	exit(1);
+}
+
+bool app_timer_reschedule(AppTimer *timer, uint32_t new_timeout_ms)
+{
+	return timer->active;
+}
+
+void app_timer_cancel(AppTimer *timer)
+{
+	timer->active = false;
+}
+
+void host_run_timers(void)
+{
+	bool fired;
+	int i;
+
+	do {
+		fired = false;
+		for (i = 0; i < MAX_TIMERS; ++i) {
+			if (timers[i].active) {
+				timers[i].active = false;
+				timers[i].callback(timers[i].data);
+				fired = true;
+			}
+		}
+	} while (fired);
+}
+
+struct Animation {
+	const AnimationImplementation *implementation;
+	AnimationHandlers handlers;
+	void *context;
+	uint32_t duration;
+	AnimationCurve curve;
+	uint32_t start;
+	uint32_t last_frame;
+};
+
+static Animation *running_animation;
+
+Animation *animation_create(void)
+{
+	return calloc(1, sizeof(Animation));
+}
+
+bool animation_destroy(Animation *animation)
+{
+	free(animation);
+	return true;
+}
+
+bool animation_set_duration(Animation *animation, uint32_t duration_ms)
+{
+	animation->duration = duration_ms;
+	return true;
+}
+
+bool animation_set_curve(Animation *animation, AnimationCurve curve)
+{
+	animation->curve = curve;
+	return true;
+}
+
+bool animation_set_implementation(Animation *animation, const AnimationImplementation *implementation)
+{
+	animation->implementation = implementation;
+	return true;
+}
+
+bool animation_set_handlers(Animation *animation, AnimationHandlers callbacks, void *context)
+{
+	animation->handlers = callbacks;
+	animation->context = context;
+	return true;
+}
+
+static void update_animation(Animation *animation, AnimationProgress progress)
+{
+	if (animation->implementation != NULL && animation->implementation->update != NULL) {
+		animation->implementation->update(animation, progress);
+	}
+}
+
+/* teardown, then the stopped handler (which may schedule the next one), then auto-destroy */
+static void stop_animation(Animation *animation, bool finished)
+{
+	running_animation = NULL;
+	if (animation->implementation != NULL && animation->implementation->teardown != NULL) {
+		animation->implementation->teardown(animation);
+	}
+	if (animation->handlers.stopped != NULL) {
+		animation->handlers.stopped(animation, finished, animation->context);
+	}
+	free(animation);
+}
+
+/* the SDK curves, closely enough: quadratic ease in and out */
+static AnimationProgress curve_progress(AnimationCurve curve, uint32_t t)
+{
+	uint32_t max = ANIMATION_NORMALIZED_MAX;
+
+	switch (curve) {
+	case AnimationCurveEaseIn:
+		return t * t / max;
+	case AnimationCurveEaseOut:
+		return max - (max - t) * (max - t) / max;
+	case AnimationCurveEaseInOut:
+		return (t < max / 2) ? 2 * t * t / max : max - 2 * (max - t) * (max - t) / max;
+	default:
+		return t;
+	}
+}
+
+/* like an SDK 3 animation with auto-destroy; without stepping the whole run happens here */
+bool animation_schedule(Animation *animation)
+{
+	if (running_animation != NULL) {
+		stop_animation(running_animation, false);
+	}
+	if (animation->handlers.started != NULL) {
+		animation->handlers.started(animation, animation->context);
+	}
+	if (animation->implementation != NULL && animation->implementation->setup != NULL) {
+		animation->implementation->setup(animation);
+	}
+	running_animation = animation;
+	animation->start = host_clock_ms;
+	animation->last_frame = host_clock_ms;
+	if (!host_animation_stepping) {
+		update_animation(animation, ANIMATION_NORMALIZED_MAX);
+		stop_animation(animation, true);
+	}
+	return true;
+}
+
+bool host_step_animation(uint32_t ms)
+{
+	Animation *animation = running_animation;
+	uint32_t elapsed;
+
+	if (animation == NULL) {
+		return false;
+	}
+	animation->last_frame += ms;
+	if (host_clock_ms < animation->last_frame) {
+		host_clock_ms = animation->last_frame;
+	}
+	elapsed = host_clock_ms - animation->start;
+	if (elapsed >= animation->duration) {
+		update_animation(animation, ANIMATION_NORMALIZED_MAX);
+		stop_animation(animation, true);
+		return running_animation != NULL;
+	}
+	update_animation(animation, curve_progress(animation->curve, (uint32_t)((uint64_t)elapsed * ANIMATION_NORMALIZED_MAX / animation->duration)));
+	return true;
+}
+
+bool animation_unschedule(Animation *animation)
+{
+	if (animation == NULL || animation != running_animation) {
+		return false;
+	}
+	stop_animation(animation, false);
+	return true;
+}
+
+bool animation_is_scheduled(Animation *animation)
+{
+	return animation != NULL && animation == running_animation;
+}
+
+uint16_t time_ms(time_t *tloc, uint16_t *out_ms)
+{
+	uint16_t ms = (uint16_t)(host_clock_ms % 1000);
+
+	if (tloc != NULL) {
+		*tloc = host_clock_ms / 1000;
+	}
+	if (out_ms != NULL) {
+		*out_ms = ms;
+	}
+	return ms;
+}
+
+size_t heap_bytes_used(void)
+{
+	return 0;
+}
+
+size_t heap_bytes_free(void)
+{
+	return 0;
+}
+
+void vibes_short_pulse(void)
+{
+}
+
+void app_event_loop(void)
+{
+	host_run_timers();
+}
+
+/******************************************************************************/
+/* Images                                                                     */
+/******************************************************************************/
+static void pack_row(int y, uint8_t *row)
+{
+	int x;
+
+	memset(row, 0, (HOST_SCREEN_WIDTH + 7) / 8);
+	for (x = 0; x < HOST_SCREEN_WIDTH; ++x) {
+		if (!host_framebuffer[y][x]) {
+			// PBM: 1 = black, MSB first
+			row[x / 8] |= (uint8_t)(0x80 >> (x % 8));
+		}
+	}
+}
+
+bool host_write_pbm(const char *path)
+{
+	uint8_t row[(HOST_SCREEN_WIDTH + 7) / 8];
+	FILE *f = fopen(path, "wb");
+	int y;
+
+	if (f == NULL) {
+		return false;
+	}
+	fprintf(f, "P4\n%d %d\n", HOST_SCREEN_WIDTH, HOST_SCREEN_HEIGHT);
+	for (y = 0; y < HOST_SCREEN_HEIGHT; ++y) {
+		pack_row(y, row);
+		fwrite(row, 1, sizeof(row), f);
+	}
+	return fclose(f) == 0;
+}
+
+bool host_compare_pbm(const char *path)
+{
+	uint8_t row[(HOST_SCREEN_WIDTH + 7) / 8];
+	uint8_t expected[(HOST_SCREEN_WIDTH + 7) / 8];
+	char header[32];
+	FILE *f = fopen(path, "rb");
+	int y;
+	bool same = true;
+
+	if (f == NULL) {
+		return false;
+	}
+	snprintf(header, sizeof(header), "P4\n%d %d\n", HOST_SCREEN_WIDTH, HOST_SCREEN_HEIGHT);
+	for (y = 0; header[y] != '\0'; ++y) {
+		if (fgetc(f) != header[y]) {
+			same = false;
+		}
+	}
+	for (y = 0; y < HOST_SCREEN_HEIGHT && same; ++y) {
+		pack_row(y, row);
+		same = fread(expected, 1, sizeof(expected), f) == sizeof(expected) && memcmp(row, expected, sizeof(row)) == 0;
+	}
+	fclose(f);
+	return same;
+}
@@ -0,0 +1,290 @@
+/*
+poscache.c -- persistent memory-mapped position cache for host tools
+
+Copyright (c) 2014 Jeffry Johnston <pebble@kidsquid.com>
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "poscache.h"
+
+#define INITIAL_CAPACITY 4096
+#define HEADER_SIZE 40
+
+typedef struct {
+	char magic[4];
+	uint32_t slot_size;
+	uint64_t table_offset;
+	uint64_t capacity;
+	uint64_t count;
+	uint64_t generation;
+} Header;
+
+typedef struct {
+	uint64_t key;
+	uint32_t value;
+	uint32_t unused;
+} Slot;
+
+struct PosCache {
+	int fd;
+	unsigned char *map;
+	size_t map_size;
+	uint64_t generation;
+	bool reading;
+	PosCacheStats stats;
+};
+
+static Header *header(PosCache *cache)
+{
+	return (Header *)cache->map;
+}
+
+static Slot *table(PosCache *cache)
+{
+	return (Slot *)(cache->map + header(cache)->table_offset);
+}
+
+/* 0 marks an empty slot, so key 0 is stored as 1 */
+static uint64_t slot_key(uint64_t key)
+{
+	return key ? key : 1;
+}
+
+static bool map_file(PosCache *cache)
+{
+	struct stat st;
+
+	if (cache->map != NULL) {
+		munmap(cache->map, cache->map_size);
+		cache->map = NULL;
+	}
+	if (fstat(cache->fd, &st) != 0) {
+		return false;
+	}
+	cache->map_size = (size_t)st.st_size;
+	cache->map = mmap(NULL, cache->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+	if (cache->map == MAP_FAILED) {
+		cache->map = NULL;
+		return false;
+	}
+	cache->generation = header(cache)->generation;
+	++cache->stats.remaps;
+	return true;
+}
+
+/* take the lock, and remap if another process has grown the table since */
+static bool lock(PosCache *cache, int operation)
+{
+	if (flock(cache->fd, operation) != 0) {
+		return false;
+	}
+	if (header(cache)->generation != cache->generation && !map_file(cache)) {
+		flock(cache->fd, LOCK_UN);
+		return false;
+	}
+	return true;
+}
+
+static void unlock(PosCache *cache)
+{
+	flock(cache->fd, LOCK_UN);
+}
+
+static Slot *find_slot(PosCache *cache, Slot *slots, uint64_t capacity, uint64_t key)
+{
+	uint64_t i = (key * 0x9e3779b97f4a7c15ull) & (capacity - 1);
+
+	while (slots[i].key != 0 && slots[i].key != key) {
+		++cache->stats.probes;
+		i = (i + 1) & (capacity - 1);
+	}
+	return &slots[i];
+}
+
+/* append a table of twice the capacity, rehash into it, then switch the header over; holds LOCK_EX */
+static bool grow(PosCache *cache)
+{
+	uint64_t old_offset = header(cache)->table_offset;
+	uint64_t old_capacity = header(cache)->capacity;
+	uint64_t capacity = old_capacity * 2;
+	uint64_t offset = cache->map_size;
+	Slot *old_slots;
+	Slot *slots;
+	uint64_t i;
+
+	if (ftruncate(cache->fd, (off_t)(offset + capacity * sizeof(Slot))) != 0) {
+		return false;
+	}
+	// the header still names the old table, so the new one can be filled in place
+	if (!map_file(cache)) {
+		return false;
+	}
+	old_slots = (Slot *)(cache->map + old_offset);
+	slots = (Slot *)(cache->map + offset);
+	for (i = 0; i < old_capacity; ++i) {
+		if (old_slots[i].key != 0) {
+			*find_slot(cache, slots, capacity, old_slots[i].key) = old_slots[i];
+		}
+	}
+	header(cache)->table_offset = offset;
+	header(cache)->capacity = capacity;
+	cache->generation = ++header(cache)->generation;
+	return true;
+}
+
+/* lay out an empty table in a new file */
+static bool create_file(int fd)
+{
+	Header h;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, "SPC1", 4);
+	h.slot_size = sizeof(Slot);
+	h.table_offset = HEADER_SIZE;
+	h.capacity = INITIAL_CAPACITY;
+	h.generation = 1;
+	return ftruncate(fd, HEADER_SIZE + INITIAL_CAPACITY * sizeof(Slot)) == 0
+		&& pwrite(fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h);
+}
+
+static bool valid_file(PosCache *cache)
+{
+	if (cache->map_size < HEADER_SIZE || memcmp(header(cache)->magic, "SPC1", 4) != 0
+			|| header(cache)->slot_size != sizeof(Slot)
+			|| header(cache)->table_offset + header(cache)->capacity * sizeof(Slot) > cache->map_size) {
+		errno = EINVAL;
+		return false;
+	}
+	return true;
+}
+
+PosCache *poscache_open(const char *path)
+{
+	PosCache *cache = calloc(1, sizeof(PosCache));
+	struct stat st;
+	bool ok;
+
+	if (cache == NULL) {
+		return NULL;
+	}
+	cache->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (cache->fd < 0) {
+		free(cache);
+		return NULL;
+	}
+
+	// the first process to get here lays out the file
+	flock(cache->fd, LOCK_EX);
+	ok = fstat(cache->fd, &st) == 0 && (st.st_size > 0 || create_file(cache->fd)) && map_file(cache) && valid_file(cache);
+	flock(cache->fd, LOCK_UN);
+	if (!ok) {
+		poscache_close(cache);
+		return NULL;
+	}
+	cache->stats.remaps = 0;
+	return cache;
+}
+
+void poscache_close(PosCache *cache)
+{
+	if (cache->map != NULL) {
+		munmap(cache->map, cache->map_size);
+	}
+	close(cache->fd);
+	free(cache);
+}
+
+bool poscache_read_begin(PosCache *cache)
+{
+	cache->reading = lock(cache, LOCK_SH);
+	return cache->reading;
+}
+
+void poscache_read_end(PosCache *cache)
+{
+	if (cache->reading) {
+		cache->reading = false;
+		unlock(cache);
+	}
+}
+
+bool poscache_get(PosCache *cache, uint64_t key, uint32_t *value)
+{
+	Slot *slot;
+	bool found;
+
+	++cache->stats.lookups;
+	if (!cache->reading && !lock(cache, LOCK_SH)) {
+		return false;
+	}
+	slot = find_slot(cache, table(cache), header(cache)->capacity, slot_key(key));
+	found = slot->key != 0;
+	if (found) {
+		*value = slot->value;
+		++cache->stats.hits;
+	}
+	if (!cache->reading) {
+		unlock(cache);
+	}
+	return found;
+}
+
+bool poscache_put(PosCache *cache, const uint64_t *keys, const uint32_t *values, size_t n)
+{
+	Slot *slot;
+	size_t i;
+
+	if (!lock(cache, LOCK_EX)) {
+		return false;
+	}
+	for (i = 0; i < n; ++i) {
+		if ((header(cache)->count + 1) * 10 > header(cache)->capacity * 7 && !grow(cache)) {
+			unlock(cache);
+			return false;
+		}
+		slot = find_slot(cache, table(cache), header(cache)->capacity, slot_key(keys[i]));
+		if (slot->key == 0) {
+			slot->key = slot_key(keys[i]);
+			++header(cache)->count;
+		}
+		slot->value = values[i];
+		++cache->stats.inserts;
+	}
+	unlock(cache);
+	return true;
+}
+
+uint64_t poscache_count(PosCache *cache)
+{
+	uint64_t count = 0;
+
+	if (lock(cache, LOCK_SH)) {
+		count = header(cache)->count;
+		unlock(cache);
+	}
+	return count;
+}
+
+const PosCacheStats *poscache_stats(const PosCache *cache)
+{
+	return &cache->stats;
+}
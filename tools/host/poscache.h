@@ -0,0 +1,74 @@
+/*
+poscache.h -- persistent memory-mapped position cache for host tools
+
+Copyright (c) 2014 Jeffry Johnston <pebble@kidsquid.com>
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef POSCACHE_H
+#define POSCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+	An open-addressed hash table of 64-bit position keys to 32-bit values in a
+	file that every process maps shared, so what one run learns the next run
+	(or a concurrent one) finds. Lookups hold a shared flock(), inserts an
+	exclusive one; a run of lookups can share one lock. When the table passes
+	70% full it grows: a table of twice the capacity is appended to the file,
+	the entries are rehashed into it, and only then does the header point at
+	it. Other processes see the new
+	generation in the header and remap. Earlier tables stay in the file as
+	dead space, less than the live table in total.
+
+	File format (host byte order):
+	Bytes	Description		Offset
+	-----	-----------		------
+	4	"SPC1"			0
+	4	slot size (16)		4
+	8	table offset		8
+	8	capacity (power of 2)	16
+	8	entries			24
+	8	generation		32
+	--
+	40
+	Slot: 8 key (0 = empty), 4 value, 4 unused.
+*/
+typedef struct PosCache PosCache;
+
+typedef struct {
+	unsigned long lookups;
+	unsigned long hits;
+	unsigned long inserts;
+	unsigned long probes;
+	unsigned long remaps;
+} PosCacheStats;
+
+/* open or create the cache file; NULL (with errno set) on failure */
+PosCache *poscache_open(const char *path);
+void poscache_close(PosCache *cache);
+/* hold the shared lock across many lookups (no inserts in between) */
+bool poscache_read_begin(PosCache *cache);
+void poscache_read_end(PosCache *cache);
+/* true and *value if key is cached */
+bool poscache_get(PosCache *cache, uint64_t key, uint32_t *value);
+/* insert or overwrite n entries under one lock; false on I/O failure */
+bool poscache_put(PosCache *cache, const uint64_t *keys, const uint32_t *values, size_t n);
+/* entries in the live table */
+uint64_t poscache_count(PosCache *cache);
+const PosCacheStats *poscache_stats(const PosCache *cache);
+
+#endif
@@ -0,0 +1,447 @@
+/*
+reference.c -- frozen reference rules engine for the differential fuzzer
+
+Copyright (c) 2014 Jeffry Johnston <pebble@kidsquid.com>
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+	The Game Logic and Game Initialization rules of src/solitaire.c as they
+	were when the replay format was introduced (move_to_tableau() already
+	returning whether the move was made), as plain rules code: the trace and
+	profiling calls of the live copy are left out. Two fixes for undefined
+	behaviour were made in both copies: unsigned arithmetic in rnd(), which
+	deals the same cards, and no negative talon_showing when draw 3 is
+	turned on with the stock empty. Do not edit the rules here: fuzz checks
+	the live engine against this copy, so a change to the rules is a change
+	to the game and belongs in a new reference with a note in the commit.
+*/
+#include <pebble.h>
+#include "reference.h"
+
+#define PILE_TABLEAU_LEFT 0
+#define PILE_TABLEAU_RIGHT 6
+#define PILE_TALON 7
+#define PILE_FOUNDATIONS 8
+#define PILE_FOUNDATION_LEFT 0
+#define PILE_FOUNDATION_RIGHT 3
+
+static int score;
+static int seed;
+static int deck[52];
+static int stock_count;
+static int talon;
+static int talon_showing;
+static int flips;
+static int stock[24];
+static int foundation[4];
+static int tableau[7][19];
+static int hidden_count[7];
+static int tableau_count[7];
+static int selection;
+static int source;
+static bool win;
+static int draw_setting;
+static int fliplimit_setting;
+
+/******************************************************************************/
+/* Game Logic                                                                 */
+/******************************************************************************/
+static int get_source_card()
+{
+	if (source < 0 || source >= PILE_FOUNDATIONS) {
+		return -1;
+	}
+	if (source == PILE_TALON) {
+		if (stock_count < talon_showing + 1) {
+			return -1;
+		}
+		return stock[talon + talon_showing];
+	}
+	if (tableau_count[source] == 0) {
+		return -1;
+	}
+	return tableau[source][tableau_count[source] - 1];
+}
+
+static void tableau_flip_top_card()
+{
+	// flip top card
+	if ((hidden_count[source] > 0) && (tableau_count[source] == hidden_count[source])) {
+		--hidden_count[source];
+	}
+}
+
+static void remove_source_card()
+{
+	int i;
+
+	if (source == PILE_TALON) {
+		--stock_count;
+		for (i = talon + talon_showing; i < stock_count; ++i) {
+			stock[i] = stock[i + 1];
+		}
+		if (talon > 0) {
+			if (talon_showing > 0) {
+				--talon_showing;
+			} else {
+				--talon;
+			}
+		}
+	} else {
+		--tableau_count[source];
+		tableau_flip_top_card();
+	}
+}
+
+static bool tableau_rules_met(int src_rank, int src_suit, bool king_allowed_on_empty)
+{
+	int dest_card;
+	int dest_rank;
+	int dest_suit;
+
+	if (tableau_count[selection] > 0) {
+		dest_card = tableau[selection][tableau_count[selection] - 1];
+		dest_rank = dest_card >> 2;
+		if (src_rank == dest_rank - 1) {
+			dest_suit = dest_card % 4;
+			if ((src_suit >> 1) != (dest_suit >> 1)) {
+				return true;
+			}
+		}
+	} else {
+		if (src_rank == 12 && king_allowed_on_empty) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool multiple_cards_are_showing(int i)
+{
+	return (tableau_count[i] > 0) && (tableau_count[i] != hidden_count[i] + 1);
+}
+
+static bool can_move_single_card_to_tableau()
+{
+	int src_card;
+	int src_rank;
+	int src_suit;
+
+	if (selection == source) {
+		return false;
+	}
+	src_card = get_source_card();
+	if (src_card < 0) {
+		return false;
+	}
+	src_rank = src_card >> 2;
+	src_suit = src_card % 4;
+	return tableau_rules_met(src_rank, src_suit, true);
+}
+
+static bool can_move_pile_to_tableau()
+{
+	int src_card;
+	int src_rank;
+	int src_suit;
+
+	if (selection == source || source > PILE_TABLEAU_RIGHT || !multiple_cards_are_showing(source)) {
+		return false;
+	}
+	src_card = tableau[source][hidden_count[source]];
+	src_rank = src_card >> 2;
+	src_suit = src_card % 4;
+	return tableau_rules_met(src_rank, src_suit, hidden_count[source] > 0);
+}
+
+static bool can_move_to_tableau()
+{
+	return (can_move_single_card_to_tableau() || can_move_pile_to_tableau());
+}
+
+static bool move_to_tableau()
+{
+	// move card or pile to tableau
+	int i;
+
+	if (can_move_single_card_to_tableau()) {
+		// move single card
+		tableau[selection][tableau_count[selection]] = get_source_card();
+		++tableau_count[selection];
+		remove_source_card();
+	} else	if (can_move_pile_to_tableau()) {
+		// source is tableau: move pile
+		for (i = hidden_count[source]; i < tableau_count[source]; ++i) {
+			tableau[selection][tableau_count[selection]] = tableau[source][i];
+			++tableau_count[selection];
+		}
+		tableau_count[source] = hidden_count[source];
+		tableau_flip_top_card();
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static int can_move_to_foundations()
+{
+	int i;
+	int src_card;
+	int src_rank;
+	int src_suit;
+	int dest_card;
+	int dest_rank;
+	int dest_suit;
+
+	src_card = get_source_card();
+	if (src_card < 0) {
+		return PILE_FOUNDATION_RIGHT + 1;
+	}
+	src_rank = src_card >> 2;
+	src_suit = src_card % 4;
+
+	for (i = PILE_FOUNDATION_LEFT; i <= PILE_FOUNDATION_RIGHT; ++i) {
+		dest_card = foundation[i];
+		if (dest_card == -1) {
+			if (src_rank != 0) {
+				continue;
+			}
+			break;
+		}
+		dest_suit = dest_card % 4;
+		if (src_suit != dest_suit) {
+			continue;
+		}
+		dest_rank = dest_card >> 2;
+		if (src_rank == dest_rank + 1) {
+			break;
+		}
+	}
+	return i;
+}
+
+static bool move_to_foundation()
+{
+	// move card to foundation
+	int i;
+	bool success = false;
+
+	i = can_move_to_foundations();
+	if (i <= PILE_FOUNDATION_RIGHT) {
+		success = true;
+		foundation[i] = get_source_card();
+		remove_source_card();
+		score += 5;
+
+		// vibrate on win
+		for (i = PILE_FOUNDATION_LEFT; i <= PILE_FOUNDATION_RIGHT; ++i) {
+			if (foundation[i] < 48) {
+				break;
+			}
+		}
+		if (i > PILE_FOUNDATION_RIGHT) {
+			vibes_short_pulse();
+			win = true;
+		}
+	}
+	return success;
+}
+
+static void automatically_move_to_foundations()
+{
+	int i;
+	bool success;
+	do {
+		success = false;
+		for (i = PILE_TABLEAU_LEFT; i <= PILE_TABLEAU_RIGHT; ++i) {
+			if (tableau_count[i] > 0) {
+				source = i;
+				if (move_to_foundation()) {
+					success = true;
+				}
+			}
+		}
+	} while (success);
+}
+
+static void deal_card_from_stock()
+{
+	if (stock_count > talon_showing + 1) {
+		if (talon + talon_showing + 1 == stock_count) {
+			if ((fliplimit_setting == 0) || (fliplimit_setting == 2 && flips < 1) || (fliplimit_setting == 3 && flips < 3)) {
+				talon = 0;
+				++flips;
+			}
+		} else {
+			talon += talon_showing + 1;
+		}
+		if (draw_setting) {
+			talon_showing = stock_count - talon - 1;
+			if (talon_showing > 2) {
+				talon_showing = 2;
+			}
+		}
+
+	}
+}
+
+
+/******************************************************************************/
+/* Game Initialization                                                        */
+/******************************************************************************/
+/* LCG pseudo-random number generator. Max may be 0-63. */
+static int rnd(int max)
+{
+	int v;
+	do {
+		seed = (int)(((unsigned)seed * 214013 + 2531011) & ((1U << 31) - 1));
+		v = seed >> 26;
+	} while (v > max);
+	return v;
+}
+
+static void toggle_draw_setting()
+{
+	if (draw_setting == 0) {
+		draw_setting = 1;
+		talon_showing = stock_count - talon - 1;
+		if (talon_showing > 2) {
+			talon_showing = 2;
+		} else if (talon_showing < 0) {
+			// empty stock
+			talon_showing = 0;
+		}
+	} else {
+		draw_setting = 0;
+		talon_showing = 0;
+	}
+}
+
+static void shuffle_and_deal()
+{
+ 	int i;
+ 	int j;
+ 	int k;
+
+	for (i = 0; i < 52; ++i) {
+		deck[i] = i;
+	}
+	for (i = 51; i >= 1; --i) {
+		j = rnd(i);
+		k = deck[j];
+		deck[j] = deck[i];
+		deck[i] = k;
+	}
+
+	/* deal */
+	for (i = 0; i < 24; ++i) {
+		stock[i] = deck[i];
+	}
+	stock_count = 24;
+	talon = 0;
+	talon_showing = draw_setting ? 2 : 0;
+	for (i = 0; i < 4; ++i) {
+		foundation[i] = -1;
+	}
+	for (i = 0, k = 24; i < 7; ++i) {
+		for (j = 0; j <= i; ++j, ++k) {
+			tableau[i][j] = deck[k];
+		}
+		hidden_count[i] = i;
+		tableau_count[i] = i + 1;
+	}
+	win = false;
+	score -= 52;
+	flips = 0;
+}
+
+/******************************************************************************/
+/* Fuzzer interface                                                           */
+/******************************************************************************/
+void reference_deal(int deal_seed, int draw, int fliplimit)
+{
+	seed = deal_seed;
+	draw_setting = draw;
+	fliplimit_setting = fliplimit;
+	score = 0;
+	shuffle_and_deal();
+}
+
+bool reference_apply(int action)
+{
+	if (action < 72) {
+		source = action / 9;
+		selection = action % 9;
+		return (selection == PILE_FOUNDATIONS) ? move_to_foundation() : move_to_tableau();
+	} else if (action == 72) {
+		deal_card_from_stock();
+	} else if (action == 73) {
+		automatically_move_to_foundations();
+	} else if (action < 82) {
+		if (draw_setting != (action - 74) / 4) {
+			toggle_draw_setting();
+		}
+		fliplimit_setting = (action - 74) % 4;
+	} else if (action == 82) {
+		score = 0;
+	}
+	return true;
+}
+
+void reference_board(unsigned char *board)
+{
+	int i;
+	int j;
+
+	memset(board, 0xff, BOARD_SIZE);
+	board[0] = stock_count;
+	board[1] = talon;
+	board[2] = talon_showing;
+	board[3] = flips;
+	board[4] = draw_setting;
+	board[5] = fliplimit_setting;
+	board[6] = win;
+	memcpy(board + 7, &score, 4);
+	for (i = 0; i < 4; ++i) {
+		board[11 + i] = foundation[i];
+	}
+	for (i = 0; i < 7; ++i) {
+		board[15 + i] = hidden_count[i];
+		board[22 + i] = tableau_count[i];
+		for (j = 0; j < tableau_count[i]; ++j) {
+			board[BOARD_TABLEAU + i * 19 + j] = tableau[i][j];
+		}
+	}
+	for (i = 0; i < stock_count; ++i) {
+		board[BOARD_STOCK + i] = stock[i];
+	}
+}
+
+int reference_legal_moves(unsigned char *actions)
+{
+	int n = 0;
+
+	for (source = PILE_TABLEAU_LEFT; source <= PILE_TALON; ++source) {
+		for (selection = PILE_TABLEAU_LEFT; selection <= PILE_FOUNDATIONS; ++selection) {
+			if (selection == PILE_TALON) {
+				continue;
+			}
+			if ((selection == PILE_FOUNDATIONS) ? can_move_to_foundations() <= PILE_FOUNDATION_RIGHT : can_move_to_tableau()) {
+				actions[n++] = source * 9 + selection;
+			}
+		}
+	}
+	return n;
+}
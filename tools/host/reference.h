@@ -0,0 +1,57 @@
+/*
+reference.h -- frozen reference rules engine for the differential fuzzer
+
+Copyright (c) 2014 Jeffry Johnston <pebble@kidsquid.com>
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef REFERENCE_H
+#define REFERENCE_H
+
+#include <stdbool.h>
+
+/*
+	Both engines describe their board in this fixed layout so fuzz can compare
+	them byte for byte and name the field that differs. Unused stock and
+	tableau slots are 0xff.
+	Bytes	Description		Offset
+	-----	-----------		------
+	1	stock_count		0
+	1	talon			1
+	1	talon_showing		2
+	1	flips			3
+	1	draw_setting		4
+	1	fliplimit_setting	5
+	1	win			6
+	4	score			7
+	4	foundation[0-3]		11
+	7	hidden_count		15
+	7	tableau_count		22
+	24	stock			29
+	7*19	tableau			53
+	--
+	186
+*/
+#define BOARD_SIZE 186
+#define BOARD_STOCK 29
+#define BOARD_TABLEAU 53
+
+/* deal seed with the given settings and a score of 0 */
+void reference_deal(int seed, int draw, int fliplimit);
+/* apply an action in the replay encoding; false if the rules refuse a move */
+bool reference_apply(int action);
+void reference_board(unsigned char *board);
+/* the moves the reference rules allow now, as replay actions; returns the count */
+int reference_legal_moves(unsigned char *actions);
+
+#endif
@@ -0,0 +1,275 @@
+/*
+render_bench.c -- host render benchmark and golden image check for solitaire.c
+
+Copyright (c) 2014 Jeffry Johnston <pebble@kidsquid.com>
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+	render_bench [--write-golden | --check-golden] [--frames N] [--golden DIR] [--resources DIR]
+
+	Builds a fixed set of board states (deal seeds, random button presses,
+	both tableau views), renders each one through game_window_layer_update_callback
+	into the host framebuffer, and reports frames per second and blits per
+	frame. With --check-golden every state is compared with its image in the
+	golden directory; --write-golden regenerates them after an intended
+	visual change. Built for a round screen, no card, selector or text in
+	the compact view may reach past the edge of the display.
+	Then card flights are stepped frame by frame, drawing only what the game
+	marks dirty and never clearing, as on the watch. Each partial frame must
+	match a full redraw of the same state, frame FLIGHT_GOLDEN_FRAME of the
+	first flight is a golden image too, and with every blit made slow the
+	frame after a slow one must be skipped.
+*/
+#include <pebble.h>
+#include <stdlib.h>
+
+static int host_deal_seed;
+#define DEAL_SEED host_deal_seed
+#define main solitaire_main
+#include "../../src/solitaire.c"
+#undef main
+
+#define SEEDS 8
+#define STEPS 3
+static const int steps[STEPS] = {0, 25, 100};
+#define FLIGHTS 4
+#define FLIGHT_GOLDEN_FRAME 3
+#define SLOW_BLIT_MS 8
+
+static uint32_t rng = 1;
+
+static int next_random(int max)
+{
+	rng = rng * 1103515245 + 12345;
+	return (int)((rng >> 16) % (uint32_t)max);
+}
+
+static void press_random()
+{
+	switch (next_random(8)) {
+	case 0:
+	case 1:
+	case 2:
+		host_press(BUTTON_ID_UP, false);
+		break;
+	case 3:
+	case 4:
+		host_press(BUTTON_ID_SELECT, false);
+		break;
+	case 5:
+	case 6:
+		host_press(BUTTON_ID_DOWN, false);
+		break;
+	default:
+		host_press(BUTTON_ID_DOWN, true);
+		break;
+	}
+}
+
+/* deal seed s, then make n random presses */
+static void set_up_state(int s, int n, int view)
+{
+	int i;
+
+	host_deal_seed = s;
+	rng = (uint32_t)s;
+	view_setting = view;
+	shuffle_and_deal();
+	for (i = 0; i < n; ++i) {
+		press_random();
+	}
+}
+
+/*
+	Press from the board of seed s until a card flies, then step the flight
+	to its end, rendering only dirty frames, with every blit taking blit_ms
+	after the first frame. Counts frames drawn and skipped, and returns the
+	number of errors: partial frames that differ from a full redraw (checked
+	without slow blits) and frames drawn straight after a slow one.
+*/
+static int fly(int s, uint32_t blit_ms, const char *golden_path, bool write_golden, bool check_golden, int *mismatches,
+	int *drawn, int *skipped)
+{
+	static uint8_t partial[HOST_SCREEN_HEIGHT][HOST_SCREEN_WIDTH];
+	uint32_t start;
+	bool slow = false;
+	int errors = 0;
+	int frame;
+	int i;
+
+	set_up_state(s, 0, VIEW_COMPACT);
+	host_render();
+	host_animation_stepping = true;
+	for (i = 0; i < 1000 && move_animation == NULL; ++i) {
+		press_random();
+	}
+	host_render();
+	host_blit_ms = blit_ms;
+	for (frame = 1; host_step_animation(ANIMATION_FRAME_MS); ++frame) {
+		if (!animation_frame) {
+			// a skipped frame draws nothing; the next automatic move starts with a full frame
+			if (!host_render_dirty()) {
+				++*skipped;
+			}
+			slow = false;
+			continue;
+		}
+		start = host_clock_ms;
+		host_render_dirty();
+		++*drawn;
+		if (slow) {
+			fprintf(stderr, "seed %d flight frame %d: drawn straight after a slow frame\n", s, frame);
+			++errors;
+		}
+		slow = host_clock_ms - start > ANIMATION_FRAME_MS;
+
+		if (frame == FLIGHT_GOLDEN_FRAME && golden_path != NULL) {
+			if (write_golden && !host_write_pbm(golden_path)) {
+				fprintf(stderr, "cannot write %s\n", golden_path);
+				exit(1);
+			}
+			if (check_golden && !host_compare_pbm(golden_path)) {
+				fprintf(stderr, "mismatch: %s\n", golden_path);
+				++*mismatches;
+			}
+		}
+		if (blit_ms == 0) {
+			// with no frame pending the game window draws the whole board
+			memcpy(partial, host_framebuffer, sizeof(partial));
+			host_render();
+			if (memcmp(partial, host_framebuffer, sizeof(partial)) != 0) {
+				fprintf(stderr, "seed %d flight frame %d: partial redraw differs from full redraw\n", s, frame);
+				++errors;
+			}
+		}
+	}
+	host_blit_ms = 0;
+	host_animation_stepping = false;
+	return errors;
+}
+
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	const char *golden = "golden";
+	bool write_golden = false;
+	bool check_golden = false;
+	long frames = 20000;
+	long per_state;
+	long f;
+	int s;
+	int n;
+	int view;
+	int mismatches = 0;
+	int errors = 0;
+	int drawn = 0;
+	int skipped = 0;
+	int slow_drawn = 0;
+	int slow_skipped = 0;
+	int i;
+	char path[512];
+	double elapsed = 0;
+	double start;
+	unsigned long blits = 0;
+	unsigned long offscreen;
+
+	host_set_resource_dir("../../resources");
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--write-golden") == 0) {
+			write_golden = true;
+		} else if (strcmp(argv[i], "--check-golden") == 0) {
+			check_golden = true;
+		} else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			frames = atol(argv[++i]);
+		} else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+			golden = argv[++i];
+		} else if (strcmp(argv[i], "--resources") == 0 && i + 1 < argc) {
+			host_set_resource_dir(argv[++i]);
+		} else {
+			fprintf(stderr, "usage: %s [--write-golden | --check-golden] [--frames N] [--golden DIR] [--resources DIR]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	score = 0;
+	state_loaded = true;
+	play_game();
+	per_state = frames / (SEEDS * STEPS * 2);
+	if (per_state < 1) {
+		per_state = 1;
+	}
+
+	for (s = 1; s <= SEEDS; ++s) {
+		for (n = 0; n < STEPS; ++n) {
+			for (view = VIEW_COMPACT; view <= VIEW_EXPANDED; ++view) {
+				set_up_state(s, steps[n], view);
+				offscreen = host_offscreen_pixels;
+				host_render();
+				if (view == VIEW_COMPACT && host_offscreen_pixels != offscreen) {
+					fprintf(stderr, "seed %d step %d: %lu pixels drawn off the round screen\n", s, steps[n],
+						host_offscreen_pixels - offscreen);
+					++errors;
+				}
+				snprintf(path, sizeof(path), "%s/seed%d_step%d_%s.pbm", golden, s, steps[n], view ? "expanded" : "compact");
+				if (write_golden && !host_write_pbm(path)) {
+					fprintf(stderr, "cannot write %s\n", path);
+					return 1;
+				}
+				if (check_golden && !host_compare_pbm(path)) {
+					fprintf(stderr, "mismatch: %s\n", path);
+					++mismatches;
+				}
+
+				blits -= host_blit_count;
+				start = now();
+				for (f = 0; f < per_state; ++f) {
+					host_render();
+				}
+				elapsed += now() - start;
+				blits += host_blit_count;
+			}
+		}
+	}
+
+	f = per_state * SEEDS * STEPS * 2;
+	printf("%ld frames over %d board states: %.0f frames/s, %.1f blits/frame\n",
+		f, SEEDS * STEPS * 2, f / elapsed, (double)blits / f);
+
+	snprintf(path, sizeof(path), "%s/seed1_flight_frame%d.pbm", golden, FLIGHT_GOLDEN_FRAME);
+	for (s = 1; s <= FLIGHTS; ++s) {
+		errors += fly(s, 0, (s == 1) ? path : NULL, write_golden, check_golden, &mismatches, &drawn, &skipped);
+	}
+	for (s = 1; s <= FLIGHTS; ++s) {
+		errors += fly(s, SLOW_BLIT_MS, NULL, false, false, &mismatches, &slow_drawn, &slow_skipped);
+	}
+	if (slow_skipped == 0) {
+		fprintf(stderr, "no frame was skipped with slow blits\n");
+		++errors;
+	}
+	printf("card flights: %d frames drawn, %d skipped; with %d ms blits: %d drawn, %d skipped; %d errors\n",
+		drawn, skipped, SLOW_BLIT_MS, slow_drawn, slow_skipped, errors);
+
+	if (check_golden) {
+		printf("golden images: %d of %d differ\n", mismatches, SEEDS * STEPS * 2 + 1);
+	}
+	return (mismatches || errors) ? 1 : 0;
+}
@@ -0,0 +1,470 @@
+/*
+replay.c -- host replay checker and rules benchmark for solitaire.c
+
+Copyright (c) 2014 Jeffry Johnston <pebble@kidsquid.com>
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+	replay [--bench N] FILE...
+	replay --from-log LOG OUT
+	replay --record SEED PRESSES OUT
+	replay --presses FILE...
+
+	Replays games recorded by the Replay section of solitaire.c (see the
+	format there) through the game logic, with no rendering or timers, and
+	checks that every deal and automatic move changes the board and that the
+	final board hash, score and win flag match the recording. A recording
+	marked truncated (longer than REPLAY_MAX_ACTIONS) is reported as such,
+	with only its actions checked. --bench replays every file N times and
+	reports actions per second. --from-log pulls the "RPL" lines written by
+	Tools > Export Replay out of a watch log (pebble logs > LOG) into a
+	replay file. --record deals SEED, plays PRESSES random button presses
+	through the game window and writes the replay it recorded, which is how
+	the starter corpus in replays/ was made. --presses plays every recorded
+	move through the game window's buttons and reports the presses each move
+	took, and how many of them picking the destination would take in fixed
+	pile order.
+*/
+#include <pebble.h>
+#include <ctype.h>
+#include <stdlib.h>
+
+static int host_deal_seed;
+#define DEAL_SEED host_deal_seed
+#define main solitaire_main
+#include "../../src/solitaire.c"
+#undef main
+
+#define REPLAY_FILE_MAX (REPLAY_HEADER_SIZE + REPLAY_MAX_ACTIONS)
+
+static uint32_t get_le(const unsigned char *p, int bytes)
+{
+	uint32_t v = 0;
+
+	while (bytes-- > 0) {
+		v = v << 8 | p[bytes];
+	}
+	return v;
+}
+
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* returns the file size, or -1 */
+static int read_replay(const char *path, unsigned char *buf)
+{
+	FILE *f;
+	int size;
+
+	f = fopen(path, "rb");
+	if (f == NULL) {
+		return -1;
+	}
+	size = (int)fread(buf, 1, REPLAY_FILE_MAX, f);
+	fclose(f);
+	return size;
+}
+
+static bool write_replay(const char *path, const unsigned char *buf, int size)
+{
+	FILE *f;
+	bool ok;
+
+	f = fopen(path, "wb");
+	if (f == NULL) {
+		return false;
+	}
+	ok = fwrite(buf, 1, size, f) == (size_t)size;
+	return fclose(f) == 0 && ok;
+}
+
+/*
+	Play a replay through the game logic. Returns NULL when the final board
+	matches the recording, or what went wrong. A truncated recording holds
+	only the first REPLAY_MAX_ACTIONS actions while its header describes the
+	final board, so only its actions are checked; *truncated is set.
+*/
+static const char *run_replay(const unsigned char *buf, int size, int *actions, bool *truncated)
+{
+	static char error[80];
+	int count;
+	int i;
+	int a;
+	int pile;
+
+	if (size < REPLAY_HEADER_SIZE || memcmp(buf, "SRP1", 4) != 0) {
+		return "not a replay";
+	}
+	count = get_le(buf + 14, 2);
+	if (size != REPLAY_HEADER_SIZE + count) {
+		return "wrong length";
+	}
+
+	draw_setting = buf[8] % 2;
+	fliplimit_setting = buf[9] % 4;
+	host_deal_seed = (int32_t)get_le(buf + 4, 4);
+	shuffle_and_deal();
+	score = (int32_t)get_le(buf + 10, 4);
+
+	for (i = 0; i < count; ++i) {
+		a = buf[REPLAY_HEADER_SIZE + i];
+		if (a < REPLAY_DEAL) {
+			source = a / REPLAY_PILES;
+			selection = a % REPLAY_PILES;
+			if (selection == PILE_TALON) {
+				snprintf(error, sizeof(error), "action %d: move %d to the talon", i, source);
+				return error;
+			}
+			if (!((selection == PILE_FOUNDATIONS) ? move_to_foundation() : move_to_tableau())) {
+				snprintf(error, sizeof(error), "action %d: move %d to %d fails", i, source, selection);
+				return error;
+			}
+		} else if (a == REPLAY_DEAL) {
+			if (!deal_card_from_stock()) {
+				snprintf(error, sizeof(error), "action %d: deal changes nothing", i);
+				return error;
+			}
+		} else if (a == REPLAY_AUTO_MOVE) {
+			auto_move_start();
+			if ((pile = auto_move_next_pile()) < 0) {
+				snprintf(error, sizeof(error), "action %d: automatic move moves nothing", i);
+				return error;
+			}
+			do {
+				source = pile;
+				move_to_foundation();
+			} while ((pile = auto_move_next_pile()) >= 0);
+		} else if (a < REPLAY_RESET_SCORE) {
+			if (draw_setting != (a - REPLAY_SETTINGS(0, 0)) / 4) {
+				toggle_draw_setting();
+			}
+			fliplimit_setting = (a - REPLAY_SETTINGS(0, 0)) % 4;
+		} else if (a == REPLAY_RESET_SCORE) {
+			score = 0;
+		} else {
+			snprintf(error, sizeof(error), "action %d: unknown action %d", i, a);
+			return error;
+		}
+	}
+	*actions = count;
+
+	*truncated = buf[16] != 0;
+	if (*truncated) {
+		return NULL;
+	}
+	if (board_hash() != get_le(buf + 22, 4)) {
+		return "board differs";
+	}
+	if ((uint32_t)score != get_le(buf + 17, 4)) {
+		snprintf(error, sizeof(error), "score %d, recorded %d", score, (int32_t)get_le(buf + 17, 4));
+		return error;
+	}
+	if (win != buf[21]) {
+		return "win flag differs";
+	}
+	return NULL;
+}
+
+/* pull "RPL <hex>" lines up to "RPL end" out of a log */
+static int replay_from_log(const char *path, unsigned char *buf)
+{
+	FILE *f;
+	char line[512];
+	char *p;
+	int size = 0;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		p = strstr(line, "RPL ");
+		if (p == NULL) {
+			continue;
+		}
+		p += 4;
+		if (strncmp(p, "end", 3) == 0) {
+			break;
+		}
+		if (strncmp(p, "none", 4) == 0) {
+			size = 0;
+			continue;
+		}
+		if (strncmp(p, "53525031", 8) == 0) {
+			// a new export starts; keep only the latest
+			size = 0;
+		}
+		while (isxdigit((unsigned char)p[0]) && isxdigit((unsigned char)p[1]) && size < REPLAY_FILE_MAX) {
+			sscanf(p, "%2hhx", &buf[size++]);
+			p += 2;
+		}
+	}
+	fclose(f);
+	return size;
+}
+
+static uint32_t rng = 1;
+
+static int next_random(int max)
+{
+	rng = rng * 1103515245 + 12345;
+	return (int)((rng >> 16) % (uint32_t)max);
+}
+
+/* deal seed, play presses random buttons through the game window */
+static int record_replay(int seed, int presses, unsigned char *buf)
+{
+	int i;
+
+	host_deal_seed = seed;
+	rng = (uint32_t)seed;
+	score = 0;
+	state_loaded = true;
+	play_game();
+	shuffle_and_deal();
+	for (i = 0; i < presses && !win; ++i) {
+		switch (next_random(8)) {
+		case 0:
+		case 1:
+		case 2:
+			host_press(BUTTON_ID_UP, false);
+			break;
+		case 3:
+		case 4:
+		case 5:
+			host_press(BUTTON_ID_SELECT, false);
+			break;
+		case 6:
+			host_press(BUTTON_ID_DOWN, false);
+			break;
+		default:
+			host_press(BUTTON_ID_DOWN, true);
+			break;
+		}
+	}
+	replay_header(buf);
+	memcpy(buf + REPLAY_HEADER_SIZE, replay_actions, replay_count);
+	return REPLAY_HEADER_SIZE + replay_count;
+}
+
+/* Up until the game window selects pile (in mode), at most 20 presses; -1 if it never does */
+static int press_up_until(int pile, int in_mode)
+{
+	int presses;
+
+	for (presses = 0; selection != pile || mode != in_mode; ++presses) {
+		if (presses == 20) {
+			return -1;
+		}
+		host_press(BUTTON_ID_UP, false);
+	}
+	return presses;
+}
+
+/* Presses to pick dest after Select on source if destinations came in the old fixed order */
+static int fixed_order_presses(int dest)
+{
+	int saved = selection;
+	int presses = 1;
+	int pile;
+
+	for (pile = PILE_TABLEAU_LEFT - 1; pile <= PILE_TABLEAU_RIGHT; ++pile) {
+		selection = (pile < PILE_TABLEAU_LEFT) ? PILE_FOUNDATIONS : pile;
+		if (selection == dest) {
+			break;
+		}
+		if (destination_pile_is_valid()) {
+			++presses;
+		}
+	}
+	selection = saved;
+	return presses;
+}
+
+/*
+	Drive the recorded moves through the game window. Returns NULL, or what
+	went wrong; adds the moves and presses it counted.
+*/
+static const char *press_replay(const unsigned char *buf, int size, long *moves, long *presses, long *dest_presses,
+	long *fixed_presses)
+{
+	static char error[80];
+	int count;
+	int i;
+	int a;
+	int n;
+
+	if (size < REPLAY_HEADER_SIZE || memcmp(buf, "SRP1", 4) != 0) {
+		return "not a replay";
+	}
+	count = get_le(buf + 14, 2);
+	draw_setting = buf[8] % 2;
+	fliplimit_setting = buf[9] % 4;
+	host_deal_seed = (int32_t)get_le(buf + 4, 4);
+	shuffle_and_deal();
+	score = (int32_t)get_le(buf + 10, 4);
+
+	for (i = 0; i < count && i + REPLAY_HEADER_SIZE < size; ++i) {
+		a = buf[REPLAY_HEADER_SIZE + i];
+		if (a < REPLAY_DEAL) {
+			n = press_up_until(a / REPLAY_PILES, MODE_SELECT_SRC);
+			if (n < 0) {
+				snprintf(error, sizeof(error), "action %d: pile %d never offered as a source", i, a / REPLAY_PILES);
+				return error;
+			}
+			host_press(BUTTON_ID_SELECT, false);
+			*fixed_presses += fixed_order_presses(a % REPLAY_PILES) + 1;
+			*presses += n + 1;
+			n = press_up_until(a % REPLAY_PILES, MODE_SELECT_DEST);
+			if (n < 0) {
+				snprintf(error, sizeof(error), "action %d: pile %d never offered as a destination", i, a % REPLAY_PILES);
+				return error;
+			}
+			host_press(BUTTON_ID_SELECT, false);
+			*presses += n + 1;
+			*dest_presses += n + 2;
+			++*moves;
+		} else if (a == REPLAY_DEAL) {
+			mode = MODE_SELECT_SRC;
+			host_press(BUTTON_ID_DOWN, false);
+			++*presses;
+		} else if (a == REPLAY_AUTO_MOVE) {
+			host_press(BUTTON_ID_DOWN, true);
+			++*presses;
+		} else if (a < REPLAY_RESET_SCORE) {
+			if (draw_setting != (a - REPLAY_SETTINGS(0, 0)) / 4) {
+				toggle_draw_setting();
+			}
+			fliplimit_setting = (a - REPLAY_SETTINGS(0, 0)) % 4;
+			select_talon();
+		} else if (a == REPLAY_RESET_SCORE) {
+			score = 0;
+		}
+	}
+	return NULL;
+}
+
+static int press_replays(int first, int argc, char **argv)
+{
+	static unsigned char buf[REPLAY_FILE_MAX];
+	const char *error;
+	long moves = 0;
+	long presses = 0;
+	long dest_presses = 0;
+	long fixed_presses = 0;
+	int failures = 0;
+	int size;
+	int i;
+
+	state_loaded = true;
+	play_game();
+	for (i = first; i < argc; ++i) {
+		size = read_replay(argv[i], buf);
+		error = (size < 0) ? "cannot read" : press_replay(buf, size, &moves, &presses, &dest_presses, &fixed_presses);
+		if (error != NULL) {
+			fprintf(stderr, "%s: %s\n", argv[i], error);
+			++failures;
+		}
+	}
+	if (moves > 0) {
+		printf("%ld moves: %.2f presses per move, %.2f to pick the destination (fixed order: %.2f)\n", moves,
+			(double)presses / moves, (double)dest_presses / moves, (double)fixed_presses / moves);
+	}
+	return failures ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	static unsigned char buf[REPLAY_FILE_MAX];
+	const char *error;
+	int size;
+	int actions;
+	int rounds = 0;
+	int failures = 0;
+	int truncations = 0;
+	bool truncated;
+	int i;
+	int first;
+	int r;
+	long total = 0;
+	double start;
+	double elapsed;
+
+	host_set_resource_dir("../../resources");
+	if (argc == 4 && strcmp(argv[1], "--from-log") == 0) {
+		size = replay_from_log(argv[2], buf);
+		if (size <= 0) {
+			fprintf(stderr, "no replay in %s\n", argv[2]);
+			return 1;
+		}
+		return write_replay(argv[3], buf, size) ? 0 : 1;
+	}
+	if (argc > 2 && strcmp(argv[1], "--presses") == 0) {
+		return press_replays(2, argc, argv);
+	}
+	if (argc == 5 && strcmp(argv[1], "--record") == 0) {
+		size = record_replay(atoi(argv[2]), atoi(argv[3]), buf);
+		return write_replay(argv[4], buf, size) ? 0 : 1;
+	}
+	i = 1;
+	if (argc > 2 && strcmp(argv[1], "--bench") == 0) {
+		rounds = atoi(argv[2]);
+		i = 3;
+	}
+	if (i >= argc) {
+		fprintf(stderr, "usage: %s [--bench N] FILE...\n"
+			"       %s --from-log LOG OUT\n"
+			"       %s --record SEED PRESSES OUT\n"
+			"       %s --presses FILE...\n", argv[0], argv[0], argv[0], argv[0]);
+		return 2;
+	}
+
+	elapsed = 0;
+	for (first = i; i < argc; ++i) {
+		size = read_replay(argv[i], buf);
+		if (size < 0) {
+			fprintf(stderr, "cannot read %s\n", argv[i]);
+			++failures;
+			continue;
+		}
+		error = run_replay(buf, size, &actions, &truncated);
+		if (error != NULL) {
+			fprintf(stderr, "%s: %s\n", argv[i], error);
+			++failures;
+			continue;
+		}
+		if (truncated) {
+			fprintf(stderr, "%s: truncated after %d actions; final board not checked\n", argv[i], actions);
+			++truncations;
+		}
+		start = now();
+		for (r = 0; r < rounds; ++r) {
+			run_replay(buf, size, &actions, &truncated);
+			total += actions;
+		}
+		elapsed += now() - start;
+	}
+
+	if (rounds > 0 && elapsed > 0) {
+		printf("%ld actions: %.0f actions/s\n", total, total / elapsed);
+	}
+	printf("replays: %d of %d differ, %d truncated\n", failures, argc - first, truncations);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,459 @@
+/*
+solve.c -- host solver for solitaire.c deals with a persistent position cache
+
+Copyright (c) 2014 Jeffry Johnston <pebble@kidsquid.com>
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+	solve [--draw N] [--fliplimit N] [--nodes N] [--cache FILE] FIRST LAST
+
+	Deals seeds FIRST to LAST with the given settings and searches each for a
+	win through the game logic in src/solitaire.c, seeing the hidden cards.
+	The search is depth first: foundation moves first, then moves that turn up
+	a hidden card, then other moves and deals, with safe moves from the
+	tableau to the foundations made without branching. A deal gives up after
+	--nodes positions (default 200000) and counts as unknown.
+	Positions are keyed by a canonical hash of the board (tableau piles in
+	sorted order, foundations by suit, and the flip count only when flips are
+	limited). With --cache, proven results go into a poscache file shared by
+	every run and process: the positions on a winning line as won, and when a
+	search ends without a win and without giving up, every position it saw
+	as lost. Searches look positions up there first, so repeating a seed
+	range is mostly cache hits.
+*/
+#include <pebble.h>
+#include <stdlib.h>
+#include "poscache.h"
+
+static int host_deal_seed;
+#define DEAL_SEED host_deal_seed
+#define main solitaire_main
+#include "../../src/solitaire.c"
+#undef main
+
+#define MAX_DEPTH 1000
+#define VISITED_BITS 20
+#define RESULT_WON 1
+#define RESULT_LOST 2
+#define RESULT_UNKNOWN 3
+
+typedef struct {
+	int stock_count;
+	int talon;
+	int talon_showing;
+	int flips;
+	bool win;
+	int stock[STOCK_SIZE];
+	int foundation[FOUNDATION_PILES];
+	int tableau[TABLEAU_PILES][TABLEAU_DEPTH];
+	int hidden_count[TABLEAU_PILES];
+	int tableau_count[TABLEAU_PILES];
+} Position;
+
+static PosCache *cache;
+static long node_limit = 200000;
+static long nodes;
+static bool gave_up;
+
+// positions seen in this search, tagged with the search number so nothing needs clearing
+static uint64_t visited_key[1 << VISITED_BITS];
+static uint32_t visited_search[1 << VISITED_BITS];
+static uint32_t search_number;
+static uint64_t *seen;
+static long seen_count;
+
+// positions on the winning line, and their distance to the win
+static uint64_t won_key[MAX_DEPTH];
+static uint32_t won_value[MAX_DEPTH];
+static int won_count;
+
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void save_position(Position *p)
+{
+	p->stock_count = stock_count;
+	p->talon = talon;
+	p->talon_showing = talon_showing;
+	p->flips = flips;
+	p->win = win;
+	memcpy(p->stock, stock, sizeof(stock));
+	memcpy(p->foundation, foundation, sizeof(foundation));
+	memcpy(p->tableau, tableau, sizeof(tableau));
+	memcpy(p->hidden_count, hidden_count, sizeof(hidden_count));
+	memcpy(p->tableau_count, tableau_count, sizeof(tableau_count));
+}
+
+static void restore_position(const Position *p)
+{
+	stock_count = p->stock_count;
+	talon = p->talon;
+	talon_showing = p->talon_showing;
+	flips = p->flips;
+	win = p->win;
+	memcpy(stock, p->stock, sizeof(stock));
+	memcpy(foundation, p->foundation, sizeof(foundation));
+	memcpy(tableau, p->tableau, sizeof(tableau));
+	memcpy(hidden_count, p->hidden_count, sizeof(hidden_count));
+	memcpy(tableau_count, p->tableau_count, sizeof(tableau_count));
+}
+
+/******************************************************************************/
+/* Canonical position hash                                                    */
+/******************************************************************************/
+#define HASH_ADD(h, v) ((h) = ((h) ^ (uint8_t)(v)) * 1099511628211ull)
+
+/* one tableau pile as bytes: hidden count, card count, cards */
+static int pile_bytes(int i, unsigned char *out)
+{
+	int j;
+
+	out[0] = (unsigned char)hidden_count[i];
+	out[1] = (unsigned char)tableau_count[i];
+	for (j = 0; j < tableau_count[i]; ++j) {
+		out[2 + j] = (unsigned char)tableau[i][j];
+	}
+	return 2 + tableau_count[i];
+}
+
+/*
+	FNV-1a (64-bit) over the board with the symmetries the rules cannot see
+	taken out: tableau piles in sorted order, foundation tops by suit rather
+	than by slot, and no flip count when flips are unlimited.
+*/
+static uint64_t canonical_hash()
+{
+	unsigned char piles[TABLEAU_PILES][2 + TABLEAU_DEPTH];
+	int length[TABLEAU_PILES];
+	int order[TABLEAU_PILES];
+	int top[4] = {-1, -1, -1, -1};
+	uint64_t h = 14695981039346656037ull;
+	int i;
+	int j;
+	int k;
+	int n;
+
+	HASH_ADD(h, draw_setting);
+	HASH_ADD(h, fliplimit_setting);
+	HASH_ADD(h, fliplimit_setting ? flips : 0);
+	HASH_ADD(h, stock_count);
+	HASH_ADD(h, talon);
+	HASH_ADD(h, talon_showing);
+	for (i = 0; i < stock_count; ++i) {
+		HASH_ADD(h, stock[i]);
+	}
+	for (i = PILE_FOUNDATION_LEFT; i <= PILE_FOUNDATION_RIGHT; ++i) {
+		if (foundation[i] >= 0 && foundation[i] >> 2 > top[foundation[i] % 4]) {
+			top[foundation[i] % 4] = foundation[i] >> 2;
+		}
+	}
+	for (i = 0; i < 4; ++i) {
+		HASH_ADD(h, top[i]);
+	}
+
+	// insertion sort of the piles by their bytes
+	for (i = PILE_TABLEAU_LEFT; i <= PILE_TABLEAU_RIGHT; ++i) {
+		length[i] = pile_bytes(i, piles[i]);
+		for (j = i; j > 0; --j) {
+			k = order[j - 1];
+			n = (length[k] < length[i]) ? length[k] : length[i];
+			if (memcmp(piles[k], piles[i], n) < 0 || (memcmp(piles[k], piles[i], n) == 0 && length[k] <= length[i])) {
+				break;
+			}
+			order[j] = k;
+		}
+		order[j] = i;
+	}
+	for (i = 0; i < TABLEAU_PILES; ++i) {
+		for (j = 0; j < length[order[i]]; ++j) {
+			HASH_ADD(h, piles[order[i]][j]);
+		}
+		HASH_ADD(h, 0xff);
+	}
+	return h;
+}
+
+/* true if key was already seen in this search; marks it seen */
+static bool visit(uint64_t key)
+{
+	uint32_t i = (uint32_t)(key >> (64 - VISITED_BITS));
+
+	while (visited_search[i] == search_number) {
+		if (visited_key[i] == key) {
+			return true;
+		}
+		i = (i + 1) & ((1 << VISITED_BITS) - 1);
+	}
+	visited_search[i] = search_number;
+	visited_key[i] = key;
+	// seen holds node_limit + 1 keys; past that the search has given up anyway
+	if (seen_count <= node_limit) {
+		seen[seen_count++] = key;
+	}
+	return false;
+}
+
+/******************************************************************************/
+/* Search                                                                     */
+/******************************************************************************/
+/* make every safe tableau to foundation move */
+static void make_safe_moves()
+{
+	bool moved = true;
+	int i;
+
+	while (moved && !win) {
+		moved = false;
+		for (i = PILE_TABLEAU_LEFT; i <= PILE_TABLEAU_RIGHT; ++i) {
+			source = i;
+			if (tableau_count[i] > 0 && foundation_move_is_safe(get_source_card())
+					&& can_move_to_foundations() <= PILE_FOUNDATION_RIGHT) {
+				move_to_foundation();
+				moved = true;
+			}
+		}
+	}
+}
+
+/* moves as replay actions, best first; returns the count */
+static int list_moves(unsigned char *moves)
+{
+	unsigned char later[REPLAY_DEAL + 1];
+	int n = 0;
+	int m = 0;
+	int src;
+	int dest;
+	bool reveals;
+
+	for (src = PILE_TABLEAU_LEFT; src <= PILE_TALON; ++src) {
+		source = src;
+		if (can_move_to_foundations() <= PILE_FOUNDATION_RIGHT) {
+			moves[n++] = (unsigned char)REPLAY_MOVE(src, PILE_FOUNDATIONS);
+		}
+	}
+	for (src = PILE_TABLEAU_LEFT; src <= PILE_TALON; ++src) {
+		source = src;
+		for (dest = PILE_TABLEAU_LEFT; dest <= PILE_TABLEAU_RIGHT; ++dest) {
+			selection = dest;
+			if (!can_move_to_tableau()) {
+				continue;
+			}
+			reveals = src != PILE_TALON && hidden_count[src] > 0
+				&& (!can_move_single_card_to_tableau() || tableau_count[src] == hidden_count[src] + 1);
+			if (reveals) {
+				moves[n++] = (unsigned char)REPLAY_MOVE(src, dest);
+			} else {
+				later[m++] = (unsigned char)REPLAY_MOVE(src, dest);
+			}
+		}
+	}
+	memcpy(moves + n, later, m);
+	n += m;
+	moves[n++] = REPLAY_DEAL;
+	return n;
+}
+
+static void apply_move(int action)
+{
+	if (action == REPLAY_DEAL) {
+		deal_card_from_stock();
+		return;
+	}
+	source = action / REPLAY_PILES;
+	selection = action % REPLAY_PILES;
+	if (selection == PILE_FOUNDATIONS) {
+		move_to_foundation();
+	} else {
+		move_to_tableau();
+	}
+}
+
+/* RESULT_WON or RESULT_LOST for this position; RESULT_UNKNOWN when the search gave up below it */
+static int search(int depth)
+{
+	unsigned char moves[REPLAY_DEAL + 1];
+	Position position;
+	uint64_t key;
+	uint32_t value;
+	int count;
+	int result = RESULT_LOST;
+	int r;
+	int i;
+
+	make_safe_moves();
+	if (win) {
+		won_count = 0;
+		return RESULT_WON;
+	}
+	key = canonical_hash();
+	if (cache != NULL && poscache_get(cache, key, &value) && (value & 3) != RESULT_UNKNOWN) {
+		if ((value & 3) == RESULT_WON) {
+			won_count = 0;
+			return RESULT_WON;
+		}
+		return RESULT_LOST;
+	}
+	if (visit(key)) {
+		return RESULT_LOST;
+	}
+	if (nodes >= node_limit || depth >= MAX_DEPTH) {
+		gave_up = true;
+		return RESULT_UNKNOWN;
+	}
+	++nodes;
+
+	save_position(&position);
+	count = list_moves(moves);
+	for (i = 0; i < count; ++i) {
+		apply_move(moves[i]);
+		r = search(depth + 1);
+		restore_position(&position);
+		if (gave_up) {
+			return RESULT_UNKNOWN;
+		}
+		if (r == RESULT_WON) {
+			won_key[won_count] = key;
+			won_value[won_count] = RESULT_WON | (uint32_t)(won_count + 1) << 2;
+			++won_count;
+			return RESULT_WON;
+		}
+		if (r == RESULT_UNKNOWN) {
+			result = RESULT_UNKNOWN;
+		}
+	}
+	return result;
+}
+
+/*
+	Deal seed and search it; stores what it proved in the cache. A deal that
+	ran out of nodes is stored under the dealt position with its node limit,
+	so it is not searched again with the same or a smaller one.
+*/
+static int solve_deal(int deal_seed)
+{
+	static uint32_t *lost;
+	uint64_t deal_key;
+	uint32_t value;
+	int result;
+	long i;
+
+	host_deal_seed = deal_seed;
+	score = 0;
+	shuffle_and_deal();
+	++search_number;
+	seen_count = 0;
+	gave_up = false;
+	nodes = 0;
+	deal_key = canonical_hash();
+	if (cache != NULL) {
+		poscache_read_begin(cache);
+		if (poscache_get(cache, deal_key, &value) && (value & 3) == RESULT_UNKNOWN && value >> 2 >= node_limit) {
+			poscache_read_end(cache);
+			return RESULT_UNKNOWN;
+		}
+	}
+	result = search(0);
+	if (cache != NULL) {
+		poscache_read_end(cache);
+	}
+	if (result == RESULT_LOST && gave_up) {
+		result = RESULT_UNKNOWN;
+	}
+
+	if (cache != NULL && result == RESULT_UNKNOWN) {
+		value = RESULT_UNKNOWN | (uint32_t)node_limit << 2;
+		poscache_put(cache, &deal_key, &value, 1);
+	} else if (cache != NULL && result == RESULT_WON) {
+		poscache_put(cache, won_key, won_value, won_count);
+	} else if (cache != NULL && result == RESULT_LOST && seen_count > 0) {
+		// the whole reachable graph was explored, so every position in it is lost
+		if (lost == NULL) {
+			lost = malloc((node_limit + 1) * sizeof(uint32_t));
+			for (i = 0; i <= node_limit; ++i) {
+				lost[i] = RESULT_LOST;
+			}
+		}
+		poscache_put(cache, seen, lost, seen_count);
+	}
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	const PosCacheStats *stats;
+	const char *cache_path = NULL;
+	long total_nodes = 0;
+	int results[4] = {0};
+	int first;
+	int last;
+	int deal;
+	int i;
+	double start;
+	double elapsed;
+
+	for (i = 1; i + 2 < argc; ++i) {
+		if (strcmp(argv[i], "--draw") == 0) {
+			draw_setting = atoi(argv[++i]) % 2;
+		} else if (strcmp(argv[i], "--fliplimit") == 0) {
+			fliplimit_setting = atoi(argv[++i]) % 4;
+		} else if (strcmp(argv[i], "--nodes") == 0) {
+			node_limit = atol(argv[++i]);
+		} else if (strcmp(argv[i], "--cache") == 0) {
+			cache_path = argv[++i];
+		} else {
+			break;
+		}
+	}
+	if (i + 2 != argc || node_limit < 1 || node_limit >= (1 << (VISITED_BITS - 1))) {
+		fprintf(stderr, "usage: %s [--draw N] [--fliplimit N] [--nodes N] [--cache FILE] FIRST LAST\n", argv[0]);
+		return 2;
+	}
+	first = atoi(argv[i]);
+	last = atoi(argv[i + 1]);
+	if (cache_path != NULL) {
+		cache = poscache_open(cache_path);
+		if (cache == NULL) {
+			perror(cache_path);
+			return 1;
+		}
+	}
+	seen = malloc((node_limit + 1) * sizeof(uint64_t));
+
+	start = now();
+	for (deal = first; deal <= last; ++deal) {
+		results[solve_deal(deal)]++;
+		total_nodes += nodes;
+	}
+	elapsed = now() - start;
+
+	printf("deals %d-%d: %d won, %d lost, %d unknown\n", first, last, results[RESULT_WON], results[RESULT_LOST],
+		results[RESULT_UNKNOWN]);
+	printf("%ld positions searched in %.2f s: %.0f positions/s\n", total_nodes, elapsed,
+		elapsed > 0 ? total_nodes / elapsed : 0);
+	if (cache != NULL) {
+		stats = poscache_stats(cache);
+		printf("cache: %llu entries, %lu lookups, %lu hits (%.1f%%), %lu inserts, %.2f probes/lookup, %lu remaps\n",
+			(unsigned long long)poscache_count(cache), stats->lookups, stats->hits,
+			stats->lookups ? 100.0 * stats->hits / stats->lookups : 0.0, stats->inserts,
+			stats->lookups ? (double)stats->probes / stats->lookups : 0.0, stats->remaps);
+		poscache_close(cache);
+	}
+	return 0;
+}
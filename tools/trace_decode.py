@@ -0,0 +1,44 @@
+#!/usr/bin/env python
+"""
+trace_decode.py -- decode solitaire trace records from the app log
+
+Usage: pebble logs | python tools/trace_decode.py [src/solitaire.c]
+
+Trace records are logged by solitaire.c (built with TRACE defined) as lines
+of the form "T" followed by 16 hex digits per record: time, tag, a, b. The
+tag holds the category bit number in its top 3 bits and the source line of
+the TRACE_* call in the rest. Each record is printed with the source line it
+came from.
+"""
+import re
+import sys
+
+CATEGORIES = ['rules', 'selection', 'deal', 'persist', 'render']
+
+
+def signed(v):
+    return v - 0x10000 if v & 0x8000 else v
+
+
+def main():
+    source = sys.argv[1] if len(sys.argv) > 1 else 'src/solitaire.c'
+    with open(source) as f:
+        lines = f.read().split('\n')
+    record = re.compile(r'\bT((?:[0-9a-f]{16})+)\s*$')
+    for log_line in sys.stdin:
+        m = record.search(log_line)
+        if not m:
+            if ' T dropped ' in log_line:
+                sys.stdout.write(log_line)
+            continue
+        hexdata = m.group(1)
+        for i in range(0, len(hexdata), 16):
+            time, tag, a, b = [int(hexdata[i + j:i + j + 4], 16) for j in range(0, 16, 4)]
+            category = CATEGORIES[tag >> 13] if (tag >> 13) < len(CATEGORIES) else '?'
+            line = tag & 0x1fff
+            text = lines[line - 1].strip() if 0 < line <= len(lines) else ''
+            print('%5u %-9s %4u a=%-5d b=%-5d %s' % (time, category, line, signed(a), signed(b), text))
+
+
+if __name__ == '__main__':
+    main()